@@ -0,0 +1,38 @@
+#include <iostream>
+#include <string>
+#include "imdb.h"
+using namespace std;
+
+static const int kWrongArgumentCount = 1;
+static const int kDatabaseNotFound = 2;
+static const int kIndexNotWritten = 3;
+
+/**
+ * Offline builder for the graph index.  Walks actordata and moviedata once and
+ * writes the compact, id-based adjacency arrays that search maps at startup.
+ * Needs to be rerun whenever the data files change; imdb::loadGraphIndex
+ * refuses to load an index built from different files.
+ */
+int main(int argc, const char *argv[]) {
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [<data-directory>]" << endl;
+    return kWrongArgumentCount;
+  }
+
+  const string directory = (argc == 2) ? argv[1] : kIMDBDataDirectory;
+  // the index is built by walking both files front to back
+  imdb db(directory, imdb::kMapSequential);
+  if (!db.good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+
+  if (!db.writeGraphIndex()) {
+    cerr << "Couldn't write the graph index to " << directory << endl;
+    return kIndexNotWritten;
+  }
+
+  cout << "Indexed " << db.getActorCount() << " actors and " << db.getMovieCount()
+       << " movies in " << directory << endl;
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include "distance-table.h"
+#include "six-degrees.h"
+using namespace std;
+
+bool distanceTable::write(const string& source, const imdb& db, const string& fileName) {
+  vector<int> distances, parent_actors, parent_movies;
+  if(!getDistancesFromActor(source, db, distances, parent_actors, parent_movies)) return false;
+
+  tableHeader header = {};
+  header.magic = kTableMagic;
+  header.version = kTableVersion;
+  header.actorSlotCount = db.getActorSlotCount();
+  header.movieSlotCount = db.getMovieSlotCount();
+  header.actorCount = db.getActorCount();
+  header.movieCount = db.getMovieCount();
+  header.sourceId = db.getActorId(source);
+  vector<uint8_t> distance_bytes(getParentsOffset(header.actorCount) - sizeof(tableHeader), kUnreached);
+  for(int id = 0; id < header.actorCount; id++)
+  {
+    if(distances[id] == -1) continue;
+    // a byte per actor keeps the table small; no real graph gets anywhere near this deep
+    if(distances[id] >= kUnreached) return false;
+    distance_bytes[id] = distances[id];
+    header.reachedCount++;
+    header.maxDistance = max(header.maxDistance, distances[id]);
+  }
+
+  // write next to the final name and rename, so readers never map a half-written table
+  const string tmpFileName = fileName + ".tmp";
+  {
+    ofstream out(tmpFileName, ios::binary | ios::trunc);
+    out.write((const char *) &header, sizeof(header));
+    out.write((const char *) distance_bytes.data(), distance_bytes.size());
+    out.write((const char *) parent_actors.data(), parent_actors.size() * sizeof(int));
+    out.write((const char *) parent_movies.data(), parent_movies.size() * sizeof(int));
+    out.close();
+    if(out.fail())
+    {
+      remove(tmpFileName.c_str());
+      return false;
+    }
+  }
+  return rename(tmpFileName.c_str(), fileName.c_str()) == 0;
+}
+
+distanceTable::distanceTable(const string& fileName, const imdb& db) :
+  db(db), fd(-1), fileSize(0), fileMap(NULL), header(nullptr) {
+  fd = open(fileName.c_str(), O_RDONLY);
+  if(fd == -1) return;
+  struct stat stats;
+  if(fstat(fd, &stats) == -1 || (size_t) stats.st_size < sizeof(tableHeader)) return;
+  fileSize = stats.st_size;
+  void *map = mmap(0, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED) return;
+  fileMap = map;
+
+  const tableHeader *candidate = (const tableHeader *) fileMap;
+  bool valid = candidate->magic == kTableMagic && candidate->version == kTableVersion &&
+    candidate->actorSlotCount == db.getActorSlotCount() && candidate->movieSlotCount == db.getMovieSlotCount() &&
+    candidate->actorCount == db.getActorCount() && candidate->movieCount == db.getMovieCount() &&
+    candidate->sourceId >= 0 && candidate->sourceId < candidate->actorCount &&
+    fileSize == getParentsOffset(candidate->actorCount) + 2 * sizeof(int) * candidate->actorCount;
+  if(!valid) return;
+
+  distances = (const uint8_t *) fileMap + sizeof(tableHeader);
+  parentActors = (const int *) ((const char *) fileMap + getParentsOffset(candidate->actorCount));
+  parentMovies = parentActors + candidate->actorCount;
+  header = candidate;
+}
+
+distanceTable::~distanceTable() {
+  if(fileMap != NULL) munmap((void *) fileMap, fileSize);
+  if(fd != -1) close(fd);
+}
+
+string_view distanceTable::getSource() const {
+  return db.getActorViewFromOffset(db.getActorOffsetFromId(header->sourceId));
+}
+
+int distanceTable::getDistance(string_view player) const {
+  int id = db.getActorId(player);
+  if(id == -1 || distances[id] == kUnreached) return -1;
+  return distances[id];
+}
+
+vector<int> distanceTable::getDistanceCounts() const {
+  vector<int> counts(header->maxDistance + 1, 0);
+  for(int id = 0; id < header->actorCount; id++)
+  {
+    if(distances[id] != kUnreached) counts[distances[id]]++;
+  }
+  return counts;
+}
+
+path distanceTable::getPath(const string& player) const {
+  path pth(player);
+  int id = db.getActorId(player);
+  if(id == -1 || distances[id] == kUnreached) return pth;
+
+  // walk the parents back up to the source, then flip the path around
+  for(; id != header->sourceId; id = parentActors[id])
+  {
+    pth.addConnection(db.getMovieFromOffset(db.getMovieOffsetFromId(parentMovies[id])),
+                      db.getActorFromOffset(db.getActorOffsetFromId(parentActors[id])));
+  }
+  pth.reverse();
+  return pth;
+}
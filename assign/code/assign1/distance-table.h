@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "imdb.h"
+#include "path.h"
+
+/**
+ * Class: distanceTable
+ * --------------------
+ * Single-source answers for six-degrees.  distanceTable::write runs one full
+ * breadth-first search from a source actor and saves, for every actor in the
+ * imdb, its distance from the source and the actor and movie it was reached
+ * through.  A distanceTable maps that file back in, after which the distance
+ * between the source and anyone else is a single array read, and the path
+ * takes one step per movie in it: no search at all.
+ *
+ * The file is indexed by the dense actor and movie ids of the imdb it was
+ * built from, so a table only opens against those same data files.
+ */
+
+class distanceTable {
+ public:
+
+/**
+ * Static Method: write
+ * --------------------
+ * Computes the table for source and writes it to fileName, returning false
+ * if source isn't in db or the file couldn't be written.
+ */
+
+  static bool write(const std::string& source, const imdb& db, const std::string& fileName);
+
+/**
+ * Constructor: distanceTable
+ * --------------------------
+ * Maps the table stored in fileName.  good() reports whether it opened and
+ * was built from db's data files.
+ */
+
+  distanceTable(const std::string& fileName, const imdb& db);
+  bool good() const { return header != nullptr; }
+
+/**
+ * Methods: getSource
+ *          getReachedCount
+ *          getMaxDistance
+ * ----------------------
+ * The actor the table was built from, how many actors (source included) are
+ * connected to it at all, and the distance of the farthest of them.
+ */
+
+  std::string_view getSource() const;
+  int getReachedCount() const { return header->reachedCount; }
+  int getMaxDistance() const { return header->maxDistance; }
+
+/**
+ * Method: getDistance
+ * -------------------
+ * Returns player's distance from the source (0 for the source itself), or -1
+ * if player isn't in the imdb or isn't connected to the source.
+ */
+
+  int getDistance(std::string_view player) const;
+
+/**
+ * Method: getDistanceCounts
+ * -------------------------
+ * Returns how many actors sit at each distance from the source: entry d of the
+ * result counts the actors at distance d.
+ */
+
+  std::vector<int> getDistanceCounts() const;
+
+/**
+ * Method: getPath
+ * ---------------
+ * Returns a shortest path from the source to player, or a path of length 0 if
+ * there's none.  Costs one step per movie in the path.
+ */
+
+  path getPath(const std::string& player) const;
+
+  ~distanceTable();
+
+ private:
+  // on-disk layout: the header is followed by one distance byte per actor id
+  // (kUnreached if not connected), padded to a multiple of four, then the
+  // parent actor ids and the parent movie ids, one int per actor id each.
+  struct tableHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t actorSlotCount;
+    uint64_t movieSlotCount;
+    int32_t actorCount;
+    int32_t movieCount;
+    int32_t sourceId;
+    int32_t reachedCount;
+    int32_t maxDistance;
+    int32_t reserved;
+  };
+  static const uint32_t kTableMagic = 0x54534449; // "IDST"
+  static const uint32_t kTableVersion = 1;
+  static constexpr uint8_t kUnreached = 0xff;
+
+  static size_t getParentsOffset(int actorCount) {
+    return sizeof(tableHeader) + (actorCount + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+  }
+
+  const imdb& db;
+  int fd;
+  size_t fileSize;
+  const void *fileMap;
+  const tableHeader *header;
+  const uint8_t *distances;
+  const int *parentActors;
+  const int *parentMovies;
+
+  distanceTable(const distanceTable& original) = delete;
+  distanceTable& operator=(const distanceTable& rhs) = delete;
+};
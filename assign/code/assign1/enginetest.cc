@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "imdb.h"
+#include "search-server.h"
+#include "six-degrees.h"
+using namespace std;
+
+static const int kWrongArguments = 1;
+static const int kDatabaseNotFound = 2;
+static const int kTestsFailed = 3;
+
+static const int kSixDegrees = 6;
+static const int kDefaultPairs = 40;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+  if (!ok) {
+    cout << "FAIL: " << what << endl;
+    failures++;
+  }
+}
+
+/**
+ * Recovers the actors along a path, first to last.  path keeps its links to
+ * itself, so this peels them off a copy from the end.
+ */
+static vector<string> getPlayers(path pth) {
+  vector<string> players;
+  while (pth.getLength() > 0) {
+    players.push_back(pth.getLastPlayer());
+    pth.undoConnection();
+  }
+  players.push_back(pth.getLastPlayer());
+  reverse(players.begin(), players.end());
+  return players;
+}
+
+/**
+ * Checks that pth runs from actor1 to actor2 and that every hop names a movie
+ * both of its actors really were in.  The movies are read back out of the
+ * printed path: each line is `<player> was in "<title>" (<year>) with <next>.`
+ */
+static bool isValidPath(const path& pth, const string& actor1, const string& actor2, const imdb& db) {
+  vector<string> players = getPlayers(pth);
+  if (players.front() != actor1 || players.back() != actor2) return false;
+
+  stringstream out;
+  out << pth;
+  string line;
+  for (size_t i = 0; i + 1 < players.size(); i++) {
+    if (!getline(out, line)) return false;
+    string prefix = players[i] + " was in \"";
+    string suffix = ") with " + players[i + 1] + ".";
+    if (line.size() < prefix.size() + suffix.size() || line.compare(0, prefix.size(), prefix) != 0 ||
+        line.compare(line.size() - suffix.size(), suffix.size(), suffix) != 0) return false;
+    string movie = line.substr(prefix.size(), line.size() - prefix.size() - suffix.size());
+    size_t split = movie.rfind("\" (");
+    if (split == string::npos) return false;
+    film credit{movie.substr(0, split), atoi(movie.c_str() + split + 3)};
+
+    vector<film> films1, films2;
+    db.getCredits(players[i], films1);
+    db.getCredits(players[i + 1], films2);
+    if (find(films1.begin(), films1.end(), credit) == films1.end() ||
+        find(films2.begin(), films2.end(), credit) == films2.end()) return false;
+  }
+  return true;
+}
+
+/**
+ * Runs every engine on one query and checks each against the plain one-sided
+ * breadth-first search: same length, and a valid path from actor1 to actor2.
+ * expectedLength, if not -1, is what the reference itself has to find.
+ */
+static void checkQuery(const string& actor1, const string& actor2, const imdb& db, int expectedLength,
+                       const string& label) {
+  path reference = getShortestPathBetweenActors(actor1, actor2, db);
+  string query = label + ": " + actor1 + " -> " + actor2;
+  if (expectedLength != -1) {
+    check((int) reference.getLength() == expectedLength, query + ": bfs found length " +
+          to_string(reference.getLength()) + ", expected " + to_string(expectedLength));
+  }
+  if (reference.getLength() > 0) check(isValidPath(reference, actor1, actor2, db), query + ": bfs path is invalid");
+
+  const char *names[] = {"bidirectional", "parallel"};
+  for (const char *name: names) {
+    path pth = getSearchEngine(name)(actor1, actor2, db);
+    check(pth.getLength() == reference.getLength(), query + ": " + name + " found length " +
+          to_string(pth.getLength()) + ", bfs " + to_string(reference.getLength()));
+    if (pth.getLength() > 0) check(isValidPath(pth, actor1, actor2, db), query + ": " + name + " path is invalid");
+  }
+}
+
+/**
+ * Checks the shared-tree search: one tree from source answers every target,
+ * and each answer has to agree with a separate one-sided search.
+ */
+static void checkSharedTree(const string& source, const vector<string>& targets, const imdb& db,
+                            const string& label) {
+  vector<path> paths = getShortestPathsFromActor(source, targets, db);
+  check(paths.size() == targets.size(), label + ": shared tree returned the wrong number of paths");
+  for (size_t i = 0; i < min(paths.size(), targets.size()); i++) {
+    string query = label + ": " + source + " -> " + targets[i];
+    path reference = getShortestPathBetweenActors(source, targets[i], db);
+    check(paths[i].getLength() == reference.getLength(), query + ": shared tree found length " +
+          to_string(paths[i].getLength()) + ", bfs " + to_string(reference.getLength()));
+    if (paths[i].getLength() > 0) {
+      check(isValidPath(paths[i], source, targets[i], db), query + ": shared tree path is invalid");
+    }
+  }
+}
+
+/**
+ * Runs the whole suite against one imdb, with or without its graph index.
+ */
+static void runTests(const imdb& db, const string& label, int numPairs) {
+  int before = failures;
+  int numActors = db.getActorCount();
+  auto actorName = [&db](int id) { return db.getActorFromOffset(db.getActorOffsetFromId(id)); };
+  mt19937 random(110);
+  uniform_int_distribution<int> anyActor(0, numActors - 1);
+
+  // one full search from a fixed actor gives pairs at known distances,
+  // including one at the six-hop limit and, if there is one, an unreachable one
+  string source = actorName(0);
+  vector<int> distances, parent_actors, parent_movies;
+  getDistancesFromActor(source, db, distances, parent_actors, parent_movies);
+  vector<int> atDistance(*max_element(distances.begin(), distances.end()) + 1, -1);
+  int unreachable = -1;
+  for (int id = 0; id < numActors; id++) {
+    if (distances[id] == -1) unreachable = id;
+    else if (atDistance[distances[id]] == -1) atDistance[distances[id]] = id;
+  }
+
+  for (size_t distance = 1; distance < atDistance.size(); distance++) {
+    checkQuery(source, actorName(atDistance[distance]), db, distance, label + ", distance " + to_string(distance));
+    checkQuery(actorName(atDistance[distance]), source, db, distance, label + ", distance " + to_string(distance));
+  }
+  if ((int) atDistance.size() <= kSixDegrees) {
+    cout << label << ": nothing is " << kSixDegrees << " hops from " << source << ", skipping that case" << endl;
+  }
+  if (unreachable != -1) {
+    checkQuery(source, actorName(unreachable), db, 0, label + ", no path");
+  } else {
+    cout << label << ": every actor is connected to " << source << ", skipping the no-path case" << endl;
+  }
+
+  checkQuery(source, source, db, 0, label + ", same actor");
+  check(answerQuery(source, source, getShortestPathBidirectional, db) == "Two actors names can not be the same!! \n",
+        label + ", same actor: answerQuery didn't reject it");
+  string bogus = "Bogus Actor (XVII)";
+  checkQuery(source, bogus, db, 0, label + ", unknown actor");
+  checkQuery(bogus, source, db, 0, label + ", unknown actor");
+  check(answerQuery(bogus, source, getShortestPathParallel, db) == "First specified actor doesn't exist in database!!\n",
+        label + ", unknown actor: answerQuery didn't reject it");
+
+  for (int i = 0; i < numPairs; i++) {
+    checkQuery(actorName(anyActor(random)), actorName(anyActor(random)), db, -1, label + ", random pair");
+  }
+
+  vector<string> targets;
+  for (size_t distance = 1; distance < atDistance.size(); distance++) targets.push_back(actorName(atDistance[distance]));
+  if (unreachable != -1) targets.push_back(actorName(unreachable));
+  targets.push_back(bogus);
+  for (int i = 0; i < numPairs / 4; i++) targets.push_back(actorName(anyActor(random)));
+  checkSharedTree(source, targets, db, label + ", shared tree");
+
+  cout << label << ": " << (failures == before ? "ok" : to_string(failures - before) + " failures") << endl;
+}
+
+static void printUsage(const char *progname) {
+  cerr << "Usage: " << progname << " [-d <data-directory>] [-n <random-pairs>]" << endl;
+}
+
+/**
+ * Checks the bidirectional, parallel and shared-tree searches against plain
+ * breadth-first search on the real data files: path lengths, path validity,
+ * and the edge cases (same actor, unknown actor, no path, six hops).  Runs on
+ * the raw data files, on the graph index if build-index has written one, and
+ * with the parallel engine on one and on several threads.
+ */
+int main(int argc, char *argv[]) {
+  string directory = kIMDBDataDirectory;
+  int numPairs = kDefaultPairs;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+    switch (opt) {
+    case 'd': directory = optarg; break;
+    case 'n': numPairs = max(0, atoi(optarg)); break;
+    default:
+      printUsage(argv[0]);
+      return kWrongArguments;
+    }
+  }
+  if (argc != optind) {
+    printUsage(argv[0]);
+    return kWrongArguments;
+  }
+
+  imdb db(directory);
+  if (!db.good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+  setParallelSearchThreads(1);
+  runTests(db, "raw data files, 1 thread", numPairs);
+  setParallelSearchThreads(4);
+  runTests(db, "raw data files, 4 threads", numPairs);
+  if (db.loadGraphIndex()) {
+    runTests(db, "graph index, 4 threads", numPairs);
+  } else {
+    cout << "No usable graph index in " << directory << ", skipping index mode" << endl;
+  }
+  return failures == 0 ? 0 : kTestsFailed;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iostream>
 
 const std::string kIMDBDataDirectory("./slink/");
@@ -46,3 +47,32 @@ struct film {
   }
 };
 
+
+/**
+ * Convenience struct: filmView
+ * ----------------------------
+ * Non-owning counterpart of film.  The title views memory owned by someone
+ * else (typically the mapped moviedata file), so building, copying and
+ * comparing filmViews never allocates.  Ordered exactly like film.
+ */
+struct filmView {
+
+  std::string_view title;
+  int year;
+
+  filmView() : year(0) {}
+  filmView(std::string_view title, int year) : title(title), year(year) {}
+  filmView(const film& movie) : title(movie.title), year(movie.year) {}
+
+  film toFilm() const { return film{std::string(title), year}; }
+
+  bool operator==(const filmView& rhs) const { 
+    return this->title == rhs.title && (this->year == rhs.year); 
+  }
+  
+  bool operator<(const filmView& rhs) const { 
+    return 
+      (this->title < rhs.title) || 
+      (this->title == rhs.title && this->year < rhs.year);
+  }
+};
@@ -5,16 +5,39 @@
 #include <unistd.h>
 #include <string.h>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
 #include "imdb.h"
+#include "name-index.h"
 using namespace std;
 
 const char *const imdb::kActorFileName = "actordata";
 const char *const imdb::kMovieFileName = "moviedata";
-imdb::imdb(const string& directory) {
+const char *const imdb::kGraphIndexFileName = "graphindex";
+imdb::imdb(const string& directory, int mapOptions) : directory(directory), mapOptions(mapOptions) {
+  graphIndexInfo = {-1, 0, NULL};
   const string actorFileName = directory + "/" + kActorFileName;
   const string movieFileName = directory + "/" + kMovieFileName;  
-  actorFile = acquireFileMap(actorFileName, actorInfo);
-  movieFile = acquireFileMap(movieFileName, movieInfo);
+  actorFile = acquireFileMap(actorFileName, actorInfo, mapOptions);
+  movieFile = acquireFileMap(movieFileName, movieInfo, mapOptions);
+}
+
+bool imdb::parseMapOptions(string_view names, int& mapOptions) {
+  static const pair<string_view, int> kNamedOptions[] = {
+    {"populate", kMapPopulate}, {"lock", kMapLock}, {"random", kMapRandom}, {"sequential", kMapSequential}
+  };
+  while(!names.empty())
+  {
+    string_view name = names.substr(0, names.find(','));
+    names.remove_prefix(min(names.size(), name.size() + 1));
+    auto found = find_if(begin(kNamedOptions), end(kNamedOptions),
+                         [name](const pair<string_view, int>& option) { return option.first == name; });
+    if(found == end(kNamedOptions)) return false;
+    mapOptions |= found->second;
+  }
+  return true;
 }
 
 bool imdb::good() const {
@@ -25,25 +48,19 @@ bool imdb::good() const {
 imdb::~imdb() {
   releaseFileMap(actorInfo);
   releaseFileMap(movieInfo);
+  releaseFileMap(graphIndexInfo);
 }
 
 bool imdb::getCredits(const string& player, vector<film>& films) const { 
   films.clear();
-  const int *countp = (const int *) actorFile;
-  const int *begin = (const int *) actorFile + 1;
-  const int *end = begin + *countp;
-  const int *found = lower_bound(begin, end, player, [this](int offset, const string& player) {
-      return getActorFromOffset(offset).compare(player) < 0;
-  });
-  
-  if((found != end) && (getActorFromOffset(*found) != player))
+  span<const int> movie_offsets;
+  if(!getCredits(player, movie_offsets))
   {
     return false;
   }
 
-  auto [nof_movies, movies_begin] = getActorMoviesData(*found, player);
-  const int *movies_end = movies_begin + nof_movies;
-  std::transform(movies_begin, movies_end, std::back_inserter(films), [this](int movie_offset){
+  films.reserve(movie_offsets.size());
+  std::transform(movie_offsets.begin(), movie_offsets.end(), std::back_inserter(films), [this](int movie_offset){
     return getMovieFromOffset(movie_offset);
   });
 
@@ -52,34 +69,278 @@ bool imdb::getCredits(const string& player, vector<film>& films) const {
 
 bool imdb::getCast(const film& movie, vector<string>& players) const {
   players.clear();
+  span<const int> actor_offsets;
+  if(!getCast(filmView(movie), actor_offsets))
+  {
+    return false;
+  }
+  
+  players.reserve(actor_offsets.size());
+  std::transform(actor_offsets.begin(), actor_offsets.end(), std::back_inserter(players), [this](int actor_offset){
+    return getActorFromOffset(actor_offset);
+  });
+
+  return true;
+}
+
+bool imdb::getCredits(string_view player, span<const int>& movie_offsets) const {
+  int actor_offset = getActorOffset(player);
+  movie_offsets = (actor_offset == -1) ? span<const int>() : getCreditOffsets(actor_offset);
+  return actor_offset != -1;
+}
+
+bool imdb::getCast(const filmView& movie, span<const int>& actor_offsets) const {
+  int movie_offset = getMovieOffset(movie);
+  actor_offsets = (movie_offset == -1) ? span<const int>() : getCastOffsets(movie_offset);
+  return movie_offset != -1;
+}
+
+int imdb::getActorOffset(string_view player) const {
+  const int *found = findActorEntry(player);
+  return (found == nullptr) ? -1 : *found;
+}
+
+int imdb::getMovieOffset(const filmView& movie) const {
+  const int *found = findMovieEntry(movie);
+  return (found == nullptr) ? -1 : *found;
+}
+
+int imdb::getActorId(string_view player) const {
+  const int *found = findActorEntry(player);
+  return (found == nullptr) ? -1 : found - ((const int *) actorFile + 1);
+}
+
+int imdb::getMovieId(const filmView& movie) const {
+  const int *found = findMovieEntry(movie);
+  return (found == nullptr) ? -1 : found - ((const int *) movieFile + 1);
+}
+
+const int *imdb::findActorEntry(string_view player) const {
+  const int *countp = (const int *) actorFile;
+  const int *begin = (const int *) actorFile + 1;
+  const int *end = begin + *countp;
+  const int *found = lower_bound(begin, end, player, [this](int offset, string_view player) {
+      return getActorViewFromOffset(offset) < player;
+  });
+  
+  if((found == end) || (getActorViewFromOffset(*found) != player))
+  {
+    return nullptr;
+  }
+  return found;
+}
+
+const int *imdb::findMovieEntry(const filmView& movie) const {
   const int* p_count = (const int *) movieFile;
   const int* begin = (const int *) movieFile + 1;
   const int* end = begin + *p_count;
-  const int* p_found_movie_offset = lower_bound(begin, end, movie, [this](int offset, const film& movie)
+  const int* p_found_movie_offset = lower_bound(begin, end, movie, [this](int offset, const filmView& movie)
   {
-    return getMovieFromOffset(offset) < movie;
+    return getMovieViewFromOffset(offset) < movie;
   });
 
-  if((p_found_movie_offset != end) && !(getMovieFromOffset(*p_found_movie_offset) == movie))
+  if((p_found_movie_offset == end) || !(getMovieViewFromOffset(*p_found_movie_offset) == movie))
   {
-    return false;
+    return nullptr;
   }
-  
-  auto [nof_actors, actors_begin] = getMovieActorsData(*p_found_movie_offset, movie);
-  const int *actors_end = actors_begin + nof_actors;
-  std::transform(actors_begin, actors_end, std::back_inserter(players), [this](int actor_offset){
-    return getActorFromOffset(actor_offset);
+  return p_found_movie_offset;
+}
+
+span<const int> imdb::getCreditOffsets(int actor_offset) const
+{
+  const char *p_actor = (const char *)actorFile + actor_offset;
+  int relative_offset = getActorViewFromOffset(actor_offset).size() + 1;
+
+  return getArrayDataFromPointers(relative_offset, p_actor);
+}
+
+span<const int> imdb::getCastOffsets(int movie_offset) const
+{
+  const char *p_movie = (const char *)movieFile + movie_offset;
+  int relative_offset = getMovieViewFromOffset(movie_offset).title.size() + 2; // characters + '\0' + byte for year
+
+  return getArrayDataFromPointers(relative_offset, p_movie);
+}
+
+vector<string_view> imdb::getActorsWithPrefix(string_view prefix, size_t limit) const {
+  const int *begin = (const int *) actorFile + 1;
+  const int *end = begin + getActorCount();
+  const int *found = lower_bound(begin, end, prefix, [this](int offset, string_view prefix) {
+      return getActorViewFromOffset(offset) < prefix;
+  });
+
+  vector<string_view> players;
+  for(; found != end && players.size() < limit; found++)
+  {
+    string_view player = getActorViewFromOffset(*found);
+    if(player.substr(0, prefix.size()) != prefix) break;
+    players.push_back(player);
+  }
+  return players;
+}
+
+vector<filmView> imdb::getMoviesWithPrefix(string_view prefix, size_t limit) const {
+  const int *begin = (const int *) movieFile + 1;
+  const int *end = begin + getMovieCount();
+  const int *found = lower_bound(begin, end, prefix, [this](int offset, string_view prefix) {
+      return getMovieViewFromOffset(offset).title < prefix;
   });
 
+  vector<filmView> movies;
+  for(; found != end && movies.size() < limit; found++)
+  {
+    filmView movie = getMovieViewFromOffset(*found);
+    if(movie.title.substr(0, prefix.size()) != prefix) break;
+    movies.push_back(movie);
+  }
+  return movies;
+}
+
+vector<string_view> imdb::getClosestActors(string_view player, int maxDistance, size_t limit) const {
+  call_once(actorNamesBuilt, [this] {
+    actorNames = make_unique<nameIndex>(getActorCount(), [this](int id) {
+      return getActorViewFromOffset(getActorOffsetFromId(id));
+    });
+  });
+
+  vector<string_view> players;
+  for(int id: actorNames->findClosest(player, maxDistance, limit))
+  {
+    players.push_back(getActorViewFromOffset(getActorOffsetFromId(id)));
+  }
+  return players;
+}
+
+vector<filmView> imdb::getClosestMovies(string_view title, int maxDistance, size_t limit) const {
+  call_once(movieTitlesBuilt, [this] {
+    movieTitles = make_unique<nameIndex>(getMovieCount(), [this](int id) {
+      return getMovieViewFromOffset(getMovieOffsetFromId(id)).title;
+    });
+  });
+
+  vector<filmView> movies;
+  for(int id: movieTitles->findClosest(title, maxDistance, limit))
+  {
+    movies.push_back(getMovieViewFromOffset(getMovieOffsetFromId(id)));
+  }
+  return movies;
+}
+
+bool imdb::writeGraphIndex() const {
+  // the data files reference records by offset, so first build offset -> id
+  // lookups; records are 4-byte aligned, so offset / 4 is a unique slot
+  vector<int> actor_ids(getActorSlotCount(), -1);
+  vector<int> movie_ids(getMovieSlotCount(), -1);
+  for(int id = 0; id < getActorCount(); id++) actor_ids[getActorOffsetFromId(id) / sizeof(int)] = id;
+  for(int id = 0; id < getMovieCount(); id++) movie_ids[getMovieOffsetFromId(id) / sizeof(int)] = id;
+
+  vector<int> credits_start{0}, credits;
+  for(int id = 0; id < getActorCount(); id++)
+  {
+    for(int movie_offset: getCreditOffsets(getActorOffsetFromId(id))) credits.push_back(movie_ids[movie_offset / sizeof(int)]);
+    credits_start.push_back(credits.size());
+  }
+  vector<int> cast_start{0}, cast;
+  for(int id = 0; id < getMovieCount(); id++)
+  {
+    for(int actor_offset: getCastOffsets(getMovieOffsetFromId(id))) cast.push_back(actor_ids[actor_offset / sizeof(int)]);
+    cast_start.push_back(cast.size());
+  }
+
+  graphIndexHeader header;
+  header.magic = kGraphIndexMagic;
+  header.version = kGraphIndexVersion;
+  header.actorFileSize = actorInfo.fileSize;
+  header.movieFileSize = movieInfo.fileSize;
+  header.actorCount = getActorCount();
+  header.movieCount = getMovieCount();
+  header.creditCount = credits.size();
+  header.castCount = cast.size();
+
+  // write next to the final name and rename, so readers never map a half-written index
+  const string indexFileName = directory + "/" + kGraphIndexFileName;
+  const string tmpFileName = indexFileName + ".tmp";
+  {
+    ofstream out(tmpFileName, ios::binary | ios::trunc);
+    out.write((const char *) &header, sizeof(header));
+    for(const vector<int> *section: {&credits_start, &credits, &cast_start, &cast})
+    {
+      out.write((const char *) section->data(), section->size() * sizeof(int));
+    }
+    // the last buffered bytes only reach the file on close, and may fail there
+    out.close();
+    if(out.fail())
+    {
+      remove(tmpFileName.c_str());
+      return false;
+    }
+  }
+  return rename(tmpFileName.c_str(), indexFileName.c_str()) == 0;
+}
+
+bool imdb::loadGraphIndex() {
+  if(!good()) return false;
+  if(hasGraphIndex()) return true;
+  const string indexFileName = directory + "/" + kGraphIndexFileName;
+  if(access(indexFileName.c_str(), R_OK) != 0) return false;
+  const char *indexFile = (const char *) acquireFileMap(indexFileName, graphIndexInfo, mapOptions);
+  if(indexFile == NULL) return false;
+
+  const graphIndexHeader *header = (const graphIndexHeader *) indexFile;
+  bool valid = graphIndexInfo.fileSize >= sizeof(graphIndexHeader) &&
+    header->magic == kGraphIndexMagic && header->version == kGraphIndexVersion &&
+    header->actorFileSize == actorInfo.fileSize && header->movieFileSize == movieInfo.fileSize &&
+    header->actorCount == getActorCount() && header->movieCount == getMovieCount() &&
+    graphIndexInfo.fileSize == sizeof(graphIndexHeader) + sizeof(int) *
+      ((size_t) header->actorCount + 1 + header->creditCount + header->movieCount + 1 + header->castCount);
+  if(!valid)
+  {
+    releaseFileMap(graphIndexInfo);
+    graphIndexInfo = {-1, 0, NULL};
+    return false;
+  }
+
+  const int *section = (const int *) (indexFile + sizeof(graphIndexHeader));
+  graphIndex.creditsStart = section;
+  section += header->actorCount + 1;
+  graphIndex.credits = span<const int>(section, header->creditCount);
+  section += header->creditCount;
+  graphIndex.castStart = section;
+  section += header->movieCount + 1;
+  graphIndex.cast = span<const int>(section, header->castCount);
+  graphIndex.header = header;
   return true;
 }
 
-const void *imdb::acquireFileMap(const string& fileName, struct fileInfo& info) {
+/**
+ * On any failure (missing file, no read permission, empty file, mmap error)
+ * info is left as {-1, 0, NULL} and NULL is returned, so good() and
+ * releaseFileMap never see a half-acquired mapping.
+ */
+const void *imdb::acquireFileMap(const string& fileName, struct fileInfo& info, int mapOptions) {
+  info = {-1, 0, NULL};
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1) return NULL;
   struct stat stats;
-  stat(fileName.c_str(), &stats);
-  info.fileSize = stats.st_size;
-  info.fd = open(fileName.c_str(), O_RDONLY);
-  return info.fileMap = mmap(0, info.fileSize, PROT_READ, MAP_SHARED, info.fd, 0);
+  if (fstat(fd, &stats) == -1 || stats.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t fileSize = stats.st_size;
+  int flags = MAP_SHARED | ((mapOptions & kMapPopulate) ? MAP_POPULATE : 0);
+  void *fileMap = mmap(0, fileSize, PROT_READ, flags, fd, 0);
+  if (fileMap == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  if (mapOptions & kMapRandom) madvise(fileMap, fileSize, MADV_RANDOM);
+  else if (mapOptions & kMapSequential) madvise(fileMap, fileSize, MADV_SEQUENTIAL);
+  if ((mapOptions & kMapLock) && mlock(fileMap, fileSize) == -1)
+    cerr << "Warning: couldn't lock " << fileName << " in memory: " << strerror(errno) << endl;
+
+  info = {fd, fileSize, fileMap};
+  return fileMap;
 }
 
 void imdb::releaseFileMap(struct fileInfo& info) {
@@ -87,37 +348,29 @@ void imdb::releaseFileMap(struct fileInfo& info) {
   if (info.fd != -1) close(info.fd);
 }
 
-film imdb::getMovieFromOffset(int movie_offset)const
+filmView imdb::getMovieViewFromOffset(int movie_offset)const
 {
   const char *movie_location = (const char *)movieFile + movie_offset;
-  film movie;
-  movie.title = string(movie_location);
-  movie.year = (int) *((const char *) movie_location + movie.title.size() + 1);
-  return movie;
+  string_view title(movie_location);
+  return filmView(title, (int) *((const char *) movie_location + title.size() + 1));
 }
 
-string imdb::getActorFromOffset(int actor_offset)const
+string_view imdb::getActorViewFromOffset(int actor_offset)const
 {
-  return string((const char *) actorFile + actor_offset);
+  return string_view((const char *) actorFile + actor_offset);
 }
 
-std::pair<int, const int*> imdb::getActorMoviesData(int actor_offset, const string& actor)const
+film imdb::getMovieFromOffset(int movie_offset)const
 {
-  const char *p_actor = (const char *)actorFile + actor_offset;
-  int relative_offset = actor.size() + 1;
-
-  return getArrayDataFromPointers(relative_offset, p_actor);
+  return getMovieViewFromOffset(movie_offset).toFilm();
 }
 
-std::pair<int, const int *> imdb::getMovieActorsData(int movie_offset, const film& movie)const
+string imdb::getActorFromOffset(int actor_offset)const
 {
-  const char *p_movie = (const char *) movieFile + movie_offset;
-  int relative_offset = movie.title.size() + 2; // characters + '\0' + byte for year
-  
-  return getArrayDataFromPointers(relative_offset, p_movie);
+  return string(getActorViewFromOffset(actor_offset));
 }
 
-std::pair<int, const int*> imdb::getArrayDataFromPointers(int relative_offset, const char* p_data)const
+span<const int> imdb::getArrayDataFromPointers(int relative_offset, const char* p_data)const
 {
   if(relative_offset % 2 != 0) relative_offset++;
   int nof_elements = *((short *)(p_data + relative_offset));
@@ -125,5 +378,5 @@ std::pair<int, const int*> imdb::getArrayDataFromPointers(int relative_offset, c
   if(relative_offset % 4 != 0) relative_offset += 2;
 
   const int *array_begin = (const int *)(p_data + relative_offset);
-  return {nof_elements, array_begin};
+  return {array_begin, (size_t) nof_elements};
 }
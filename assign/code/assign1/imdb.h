@@ -1,8 +1,15 @@
 #pragma once
 #include "imdb-utils.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+class nameIndex;
+
 class imdb {
  public:
   
@@ -18,7 +25,34 @@ class imdb {
  * @param directory the name of the directory housing the formatted information backing the imdb.
  */
 
-  imdb(const std::string& directory);
+  imdb(const std::string& directory, int mapOptions = kMapDefault);
+
+/**
+ * Constants: kMapDefault, kMapPopulate, kMapLock, kMapRandom, kMapSequential
+ * --------------------------------------------------------------------------
+ * Flags that can be or'ed together and passed as the constructor's second
+ * argument to control how the data files (and the graph index) get mapped:
+ *
+ *     kMapPopulate   pre-fault every page at startup (MAP_POPULATE), so the first
+ *                    queries don't pay for page faults on the multi-hundred-MB files.
+ *     kMapLock       mlock the mappings so they can't be paged out.  This is best
+ *                    effort: if RLIMIT_MEMLOCK is too low, a warning is printed and
+ *                    the imdb is still usable.
+ *     kMapRandom     madvise(MADV_RANDOM): turn kernel read-ahead off, which suits
+ *                    the scattered lookups a search makes.
+ *     kMapSequential madvise(MADV_SEQUENTIAL): aggressive read-ahead, for callers
+ *                    that walk the files front to back (like build-index).
+ *
+ * parseMapOptions turns a comma-separated list of populate, lock, random and
+ * sequential into those flags, returning false on an unknown name.
+ */
+
+  static constexpr int kMapDefault = 0;
+  static constexpr int kMapPopulate = 1 << 0;
+  static constexpr int kMapLock = 1 << 1;
+  static constexpr int kMapRandom = 1 << 2;
+  static constexpr int kMapSequential = 1 << 3;
+  static bool parseMapOptions(std::string_view names, int& mapOptions);
 
 /**
  * Predicate Method: good
@@ -69,6 +103,164 @@ class imdb {
 
   bool getCast(const film& movie, std::vector<std::string>& players) const;
 
+/**
+ * Methods: getCredits
+ *          getCast
+ * -------------------
+ * Allocation-free versions of the lookups above.  Rather than copying names and
+ * titles out, they hand back a span over the raw array of movie offsets (for an
+ * actor) or actor offsets (for a movie) that lives inside the mapped file.  The
+ * span stays valid for as long as the imdb does; if the key isn't in the
+ * database, the span is left empty and false is returned.
+ */
+
+  bool getCredits(std::string_view player, std::span<const int>& movie_offsets) const;
+  bool getCast(const filmView& movie, std::span<const int>& actor_offsets) const;
+
+/**
+ * Methods: getActorOffset
+ *          getMovieOffset
+ * ------------------------
+ * Binary searches the sorted actor (or movie) table and returns the byte offset
+ * of the matching record within actordata (or moviedata), or -1 if it isn't in
+ * the database.  Offsets are what the raw files use to reference each other, so
+ * clients that only need the shape of the graph can stay in offset space and
+ * turn offsets back into names with getActorFromOffset/getMovieFromOffset.
+ * Neither search allocates: every probe compares string_views into the mapping.
+ */
+
+  int getActorOffset(std::string_view player) const;
+  int getMovieOffset(const filmView& movie) const;
+
+/**
+ * Methods: getCreditOffsets
+ *          getCastOffsets
+ * ------------------------
+ * Return the array of movie offsets (for an actor) or actor offsets (for a movie)
+ * stored right after the record at the specified offset.  The span points
+ * straight into the mapped file, so nothing is allocated or copied.
+ */
+
+  std::span<const int> getCreditOffsets(int actor_offset) const;
+  std::span<const int> getCastOffsets(int movie_offset) const;
+
+/**
+ * Methods: getActorViewFromOffset
+ *          getMovieViewFromOffset
+ *          getActorFromOffset
+ *          getMovieFromOffset
+ * --------------------------------
+ * Decode the record at the specified offset.  The view versions point into the
+ * mapped file; the others make owning copies.
+ */
+
+  std::string_view getActorViewFromOffset(int actor_offset) const;
+  filmView getMovieViewFromOffset(int movie_offset) const;
+  std::string getActorFromOffset(int actor_offset) const;
+  film getMovieFromOffset(int movie_offset) const;
+
+/**
+ * Methods: getActorSlotCount
+ *          getMovieSlotCount
+ * ---------------------------
+ * Every record in actordata and moviedata is padded to a multiple of four bytes,
+ * so offset / 4 is a unique index for each actor (or movie) that is always below
+ * the returned count.  Handy for sizing flat visited/parent arrays.
+ */
+
+  size_t getActorSlotCount() const { return actorInfo.fileSize / sizeof(int); }
+  size_t getMovieSlotCount() const { return movieInfo.fileSize / sizeof(int); }
+
+/**
+ * Methods: getActorCount
+ *          getMovieCount
+ *          getActorId
+ *          getMovieId
+ *          getActorOffsetFromId
+ *          getMovieOffsetFromId
+ * ------------------------------
+ * Every actor and movie also has a dense id: its position in the sorted offset
+ * table at the front of actordata (or moviedata).  Ids run from 0 to the count
+ * minus one, so they can index arrays directly.  getActorId/getMovieId return -1
+ * if the key isn't in the database.
+ */
+
+  int getActorCount() const { return *(const int *) actorFile; }
+  int getMovieCount() const { return *(const int *) movieFile; }
+  int getActorId(std::string_view player) const;
+  int getMovieId(const filmView& movie) const;
+  int getActorOffsetFromId(int actor_id) const { return ((const int *) actorFile)[actor_id + 1]; }
+  int getMovieOffsetFromId(int movie_id) const { return ((const int *) movieFile)[movie_id + 1]; }
+
+/**
+ * Method: writeGraphIndex
+ * -----------------------
+ * Builds the graph index, a compressed sparse row form of the actor/movie graph
+ * expressed entirely in dense ids, and writes it to the graphindex file in the
+ * imdb's directory.  This walks every record in both data files, so it's meant
+ * to be run once, offline (see build-index), whenever the data files change.
+ *
+ * @return true if and only if the index was written in full.
+ */
+
+  bool writeGraphIndex() const;
+
+/**
+ * Methods: loadGraphIndex
+ *          hasGraphIndex
+ * -----------------------
+ * loadGraphIndex maps the graphindex file written by writeGraphIndex.  It returns
+ * false (and leaves the imdb usable without an index) if the file is missing,
+ * malformed or was built from different data files.
+ */
+
+  bool loadGraphIndex();
+  bool hasGraphIndex() const { return graphIndex.header != nullptr; }
+
+/**
+ * Methods: getCreditIds
+ *          getCastIds
+ * --------------------
+ * Return the movie ids an actor appeared in, or the actor ids starring in a movie,
+ * straight out of the mapped graph index.  Only valid once loadGraphIndex has
+ * succeeded.
+ */
+
+  std::span<const int> getCreditIds(int actor_id) const {
+    return graphIndex.credits.subspan(graphIndex.creditsStart[actor_id],
+                                      graphIndex.creditsStart[actor_id + 1] - graphIndex.creditsStart[actor_id]);
+  }
+  std::span<const int> getCastIds(int movie_id) const {
+    return graphIndex.cast.subspan(graphIndex.castStart[movie_id],
+                                   graphIndex.castStart[movie_id + 1] - graphIndex.castStart[movie_id]);
+  }
+
+/**
+ * Methods: getActorsWithPrefix
+ *          getMoviesWithPrefix
+ * -----------------------------
+ * Return up to limit actors (or movies) whose name starts with prefix, in sorted
+ * order.  Both are a binary search plus a walk along the sorted table, and the
+ * results point into the mapped files, so nothing is copied.
+ */
+
+  std::vector<std::string_view> getActorsWithPrefix(std::string_view prefix, size_t limit) const;
+  std::vector<filmView> getMoviesWithPrefix(std::string_view prefix, size_t limit) const;
+
+/**
+ * Methods: getClosestActors
+ *          getClosestMovies
+ * --------------------------
+ * Return up to limit actors (or movies, matched by title alone) whose names are
+ * within maxDistance case-insensitive edits of the query, closest first.  The
+ * trigram index behind each is built the first time it's needed (which takes a
+ * moment on the full database) and reused for every query after that; it's safe
+ * to call these from several threads at once.
+ */
+
+  std::vector<std::string_view> getClosestActors(std::string_view player, int maxDistance, size_t limit) const;
+  std::vector<filmView> getClosestMovies(std::string_view title, int maxDistance, size_t limit) const;
+
 /**
  * Destructor: ~imdb
  * -----------------
@@ -80,6 +272,9 @@ class imdb {
  private:
   static const char *const kActorFileName;
   static const char *const kMovieFileName;
+  static const char *const kGraphIndexFileName;
+  const std::string directory;
+  const int mapOptions;
   const void *actorFile;
   const void *movieFile;
   
@@ -89,21 +284,44 @@ class imdb {
     int fd;
     size_t fileSize;
     const void *fileMap;
-  } actorInfo, movieInfo;
+  } actorInfo, movieInfo, graphIndexInfo;
+
+  // on-disk layout of the graphindex file: the header is followed by the
+  // credits row starts (actor count + 1 ints), the credits (movie ids), the
+  // cast row starts (movie count + 1 ints) and the cast (actor ids).
+  struct graphIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t actorFileSize;
+    uint64_t movieFileSize;
+    int32_t actorCount;
+    int32_t movieCount;
+    int32_t creditCount;
+    int32_t castCount;
+  };
+  static const uint32_t kGraphIndexMagic = 0x58444749; // "IGDX"
+  static const uint32_t kGraphIndexVersion = 1;
+
+  struct {
+    const graphIndexHeader *header = nullptr;
+    const int *creditsStart;
+    std::span<const int> credits;
+    const int *castStart;
+    std::span<const int> cast;
+  } graphIndex;
+
+  mutable std::once_flag actorNamesBuilt, movieTitlesBuilt;
+  mutable std::unique_ptr<nameIndex> actorNames, movieTitles;
   
-  static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info);
+  static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info, int mapOptions);
   static void releaseFileMap(struct fileInfo& info);
 
   imdb(const imdb& original) = delete;
   imdb& operator=(const imdb& rhs) = delete;
   imdb& operator=(const imdb& rhs) const = delete;
 
-  film getMovieFromOffset(int movie_offset)const;
-  std::string getActorFromOffset(int actor_offset)const;
-
-  std::pair<int, const int*> getActorMoviesData(int actor_offset, const std::string& actor)const;
-  std::pair<int, const int*> getMovieActorsData(int movie_offset, const film& movie)const;
-
-  std::pair<int, const int*> getArrayDataFromPointers(int relative_offset, const char* p_data)const;
+  std::span<const int> getArrayDataFromPointers(int relative_offset, const char* p_data)const;
+  const int *findActorEntry(std::string_view player) const;
+  const int *findMovieEntry(const filmView& movie) const;
 
 };
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "imdb.h"
+#include "six-degrees.h"
+using namespace std;
+
+static const int kWrongArguments = 1;
+static const int kDatabaseNotFound = 2;
+static const int kWorkloadNotFound = 3;
+static const int kNoGraphIndex = 4;
+
+/**
+ * Every allocation in the process goes through these, so the benchmark can
+ * report how many heap allocations each query costs.
+ */
+static atomic<size_t> allocationCount(0);
+
+void *operator new(size_t size) {
+  allocationCount.fetch_add(1, memory_order_relaxed);
+  if (void *p = malloc(size == 0 ? 1 : size)) return p;
+  throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+/**
+ * One line of the workload file.  Fields are tab-separated:
+ *
+ *     credits <actor>
+ *     cast    <title> <year>
+ *     search  <actor1> <actor2>
+ *
+ * where year is stored the way the data files store it (years since 1900).
+ * Blank lines and lines starting with # are ignored.
+ */
+struct operation {
+  enum kind { kCredits, kCast, kSearch } type;
+  string first;
+  string second;
+  int year;
+};
+
+static bool loadWorkload(const string& fileName, vector<operation>& operations) {
+  ifstream in(fileName);
+  if (!in) return false;
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    vector<string> fields;
+    stringstream tokens(line);
+    for (string field; getline(tokens, field, '\t');) fields.push_back(field);
+    if (fields[0] == "credits" && fields.size() == 2) {
+      operations.push_back({operation::kCredits, fields[1], "", 0});
+    } else if (fields[0] == "cast" && fields.size() == 3) {
+      operations.push_back({operation::kCast, fields[1], "", atoi(fields[2].c_str())});
+    } else if (fields[0] == "search" && fields.size() == 3) {
+      operations.push_back({operation::kSearch, fields[1], fields[2], 0});
+    } else {
+      cerr << "Skipping malformed workload line: " << line << endl;
+    }
+  }
+  return true;
+}
+
+/**
+ * Latencies (in microseconds) and allocation counts collected for one kind of
+ * operation under one configuration.
+ */
+struct measurements {
+  vector<double> latencies;
+  size_t allocations = 0;
+  double totalSeconds = 0;
+
+  void print(const string& label) const {
+    if (latencies.empty()) return;
+    vector<double> sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) { return sorted[min(sorted.size() - 1, (size_t) (p * sorted.size()))]; };
+    cout << "  " << left << setw(10) << label << right
+         << setw(8) << sorted.size()
+         << setw(12) << fixed << setprecision(1) << percentile(0.50)
+         << setw(12) << percentile(0.99)
+         << setw(12) << setprecision(0) << sorted.size() / totalSeconds
+         << setw(12) << setprecision(1) << (double) allocations / sorted.size() << endl;
+  }
+};
+
+/**
+ * Replays every operation repetitions times against db, timing each one, and
+ * prints a summary line per operation kind.
+ */
+static void runConfiguration(const imdb& db, SearchEngine engine, const vector<operation>& operations,
+                             int repetitions) {
+  measurements credits, cast, search;
+  vector<film> films;
+  vector<string> players;
+  for (int r = 0; r < repetitions; r++) {
+    for (const operation& op: operations) {
+      size_t allocationsBefore = allocationCount.load(memory_order_relaxed);
+      auto start = chrono::steady_clock::now();
+      measurements *bucket;
+      switch (op.type) {
+      case operation::kCredits:
+        db.getCredits(op.first, films);
+        bucket = &credits;
+        break;
+      case operation::kCast:
+        db.getCast(film{op.first, op.year}, players);
+        bucket = &cast;
+        break;
+      default:
+        engine(op.first, op.second, db);
+        bucket = &search;
+      }
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      bucket->latencies.push_back(elapsed.count() * 1e6);
+      bucket->totalSeconds += elapsed.count();
+      bucket->allocations += allocationCount.load(memory_order_relaxed) - allocationsBefore;
+    }
+  }
+
+  cout << "  " << left << setw(10) << "operation" << right << setw(8) << "count" << setw(12) << "p50 (us)"
+       << setw(12) << "p99 (us)" << setw(12) << "queries/s" << setw(12) << "allocs/op" << endl;
+  credits.print("credits");
+  cast.print("cast");
+  search.print("search");
+}
+
+static long getPeakRSSKilobytes() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * Runs one configuration in a child process, which loads its own copy of the
+ * database (with the graph index if useIndex is set) and prints its results.
+ * ru_maxrss is a high-water mark for the whole process, so this is what makes
+ * each configuration's peak RSS its own rather than that of everything run
+ * before it.  Returns the child's exit status: 0, kNoGraphIndex if the index
+ * couldn't be loaded, or -1 if the child didn't finish.
+ */
+static int runConfigurationInChild(const string& directory, int mapOptions, bool useIndex, const string& label,
+                                   SearchEngine engine, const vector<operation>& operations, int repetitions) {
+  cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    auto start = chrono::steady_clock::now();
+    imdb db(directory, mapOptions);
+    if (useIndex && !db.loadGraphIndex()) _exit(kNoGraphIndex);
+    chrono::duration<double> loadTime = chrono::steady_clock::now() - start;
+    cout << endl << label << " (loaded in " << fixed << setprecision(1) << loadTime.count() * 1e3 << " ms)" << endl;
+    runConfiguration(db, engine, operations, repetitions);
+    cout << "  peak RSS " << getPeakRSSKilobytes() << " KB" << endl;
+    _exit(0);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) return -1;
+  return WEXITSTATUS(status);
+}
+
+static void printUsage(const char *progname) {
+  cerr << "Usage: " << progname << " [-d <data-directory>] [-e <engine>[,<engine>...]] [-m raw|index|both]"
+       << " [-p <map-options>] [-r <repetitions>] [-t <threads>] <workload-file>" << endl;
+  cerr << "  engines: " << kSearchEngineNames << " (default: all of them)" << endl;
+  cerr << "  map options: comma-separated populate,lock,random,sequential (see imdb.h)" << endl;
+}
+
+/**
+ * Benchmark driver: replays a workload of lookups and searches against every
+ * requested combination of search engine and index mode (raw data files vs.
+ * the graph index written by build-index) and reports latency percentiles,
+ * throughput, heap allocations per operation and peak RSS for each, so builds
+ * can be compared side by side.  Each combination runs in a process of its
+ * own, so the memory one uses doesn't show up in the next one's peak RSS.
+ */
+int main(int argc, char *argv[]) {
+  string directory = kIMDBDataDirectory;
+  string engineNames = kSearchEngineNames;
+  string mode = "both";
+  int repetitions = 1;
+  int mapOptions = imdb::kMapDefault;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:e:m:p:r:t:")) != -1) {
+    switch (opt) {
+    case 'd': directory = optarg; break;
+    case 'e': engineNames = optarg; break;
+    case 'm': mode = optarg; break;
+    case 'p':
+      if (!imdb::parseMapOptions(optarg, mapOptions)) {
+        printUsage(argv[0]);
+        return kWrongArguments;
+      }
+      break;
+    case 'r': repetitions = max(1, atoi(optarg)); break;
+    case 't': setParallelSearchThreads(max(1, atoi(optarg))); break;
+    default:
+      printUsage(argv[0]);
+      return kWrongArguments;
+    }
+  }
+  if (argc - optind != 1 || (mode != "raw" && mode != "index" && mode != "both")) {
+    printUsage(argv[0]);
+    return kWrongArguments;
+  }
+
+  vector<operation> operations;
+  if (!loadWorkload(argv[optind], operations)) {
+    cerr << "Couldn't read workload file " << argv[optind] << endl;
+    return kWorkloadNotFound;
+  }
+
+  vector<pair<string, SearchEngine>> engines;
+  replace(engineNames.begin(), engineNames.end(), '|', ',');
+  stringstream names(engineNames);
+  for (string name; getline(names, name, ',');) {
+    SearchEngine engine = getSearchEngine(name);
+    if (engine == nullptr) {
+      printUsage(argv[0]);
+      return kWrongArguments;
+    }
+    engines.push_back({name, engine});
+  }
+
+  if (!imdb(directory, mapOptions).good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+  vector<pair<string, bool>> databases;
+  if (mode != "index") databases.push_back({"raw data files", false});
+  if (mode != "raw") databases.push_back({"graph index", true});
+
+  cout << operations.size() << " operations x " << repetitions << " repetitions" << endl;
+  for (const auto& [dbName, useIndex]: databases) {
+    for (const auto& [engineName, engine]: engines) {
+      string label = "engine " + engineName + ", " + dbName;
+      int status = runConfigurationInChild(directory, mapOptions, useIndex, label, engine, operations, repetitions);
+      if (status == kNoGraphIndex) {
+        cerr << "No usable graph index in " << directory << " (run build-index), skipping index mode" << endl;
+        break;
+      }
+      if (status != 0) cerr << label << " didn't finish" << endl;
+    }
+  }
+  return 0;
+}
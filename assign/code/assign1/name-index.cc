@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+#include <string>
+#include "name-index.h"
+using namespace std;
+
+nameIndex::nameIndex(int count, const NameFunction& getName) : count(count), getName(getName) {
+  for(int id = 0; id < count; id++)
+  {
+    for(uint32_t trigram: getTrigrams(getName(id))) postings[trigram].push_back(id);
+  }
+}
+
+vector<int> nameIndex::findClosest(string_view query, int maxDistance, size_t limit) const {
+  vector<uint32_t> trigrams = getTrigrams(query);
+  int min_shared = (int) trigrams.size() - 3 * maxDistance;
+
+  vector<int> candidates;
+  if(min_shared <= 0)
+  {
+    // short query or generous distance: the filter can't rule anything out
+    candidates.resize(count);
+    iota(candidates.begin(), candidates.end(), 0);
+  }
+  else
+  {
+    unordered_map<int, int> shared;
+    for(uint32_t trigram: trigrams)
+    {
+      auto found = postings.find(trigram);
+      if(found == postings.end()) continue;
+      for(int id: found->second)
+      {
+        if(++shared[id] == min_shared) candidates.push_back(id);
+      }
+    }
+  }
+
+  vector<pair<int, int>> matches; // (distance, id)
+  for(int id: candidates)
+  {
+    int distance = editDistance(query, getName(id), maxDistance);
+    if(distance <= maxDistance) matches.push_back({distance, id});
+  }
+  sort(matches.begin(), matches.end(), [this](const pair<int, int>& lhs, const pair<int, int>& rhs) {
+    if(lhs.first != rhs.first) return lhs.first < rhs.first;
+    return getName(lhs.second) < getName(rhs.second);
+  });
+
+  vector<int> ids;
+  for(size_t i = 0; i < matches.size() && i < limit; i++) ids.push_back(matches[i].second);
+  return ids;
+}
+
+int nameIndex::editDistance(string_view a, string_view b, int maxDistance) {
+  if(abs((int) a.size() - (int) b.size()) > maxDistance) return maxDistance + 1;
+  vector<int> previous(b.size() + 1), current(b.size() + 1);
+  iota(previous.begin(), previous.end(), 0);
+  for(size_t i = 1; i <= a.size(); i++)
+  {
+    current[0] = i;
+    int row_min = current[0];
+    for(size_t j = 1; j <= b.size(); j++)
+    {
+      int substitution = (tolower((unsigned char) a[i - 1]) == tolower((unsigned char) b[j - 1])) ? 0 : 1;
+      current[j] = min({previous[j] + 1, current[j - 1] + 1, previous[j - 1] + substitution});
+      row_min = min(row_min, current[j]);
+    }
+    if(row_min > maxDistance) return maxDistance + 1;
+    swap(previous, current);
+  }
+  return min(previous[b.size()], maxDistance + 1);
+}
+
+vector<uint32_t> nameIndex::getTrigrams(string_view name) {
+  string padded = "$$";
+  for(char ch: name) padded += tolower((unsigned char) ch);
+  padded += '$';
+
+  vector<uint32_t> trigrams;
+  for(size_t i = 0; i + 3 <= padded.size(); i++)
+  {
+    trigrams.push_back(((uint32_t)(unsigned char) padded[i] << 16) |
+                       ((uint32_t)(unsigned char) padded[i + 1] << 8) |
+                       (uint32_t)(unsigned char) padded[i + 2]);
+  }
+  sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+  return trigrams;
+}
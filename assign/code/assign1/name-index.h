@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Class: nameIndex
+ * ----------------
+ * Trigram index over a fixed list of names (actor names or movie titles),
+ * answering "which names are within a few typos of this one" without
+ * comparing the query against every name.  Names are identified by their
+ * position in the list, and are fetched back through the function handed to
+ * the constructor, so the index stores nothing but trigram postings.
+ *
+ * Matching is case-insensitive.  Each name is lower-cased and padded as
+ * "$$name$", and the index maps every trigram of the padded form to the ids
+ * containing it.  A single edit (insert, delete or substitute) changes at most
+ * three trigrams, so a name within distance k of the query must share at least
+ * (query trigrams - 3k) of them; only names passing that filter have their
+ * edit distance computed.
+ */
+class nameIndex {
+ public:
+  using NameFunction = std::function<std::string_view(int id)>;
+
+  nameIndex(int count, const NameFunction& getName);
+
+/**
+ * Method: findClosest
+ * -------------------
+ * Returns the ids of at most limit names within maxDistance edits of query,
+ * closest first, with ties broken by name.
+ */
+  std::vector<int> findClosest(std::string_view query, int maxDistance, size_t limit) const;
+
+/**
+ * Function: editDistance
+ * ----------------------
+ * Case-insensitive Levenshtein distance between a and b, or maxDistance + 1 as
+ * soon as it's certain the distance exceeds maxDistance.
+ */
+  static int editDistance(std::string_view a, std::string_view b, int maxDistance);
+
+ private:
+  int count;
+  NameFunction getName;
+  std::unordered_map<uint32_t, std::vector<int>> postings;
+
+  static std::vector<uint32_t> getTrigrams(std::string_view name);
+};
@@ -0,0 +1,169 @@
+#include <map>
+#include <span>
+#include <sstream>
+#include "search-server.h"
+using namespace std;
+
+static const int kMaxSuggestionDistance = 3;
+static const size_t kMaxSuggestions = 5;
+
+/**
+ * Builds the "doesn't exist" message for a missing actor, optionally followed
+ * by the closest names in the database, since the usual cause is a typo.
+ */
+static string missingActorMessage(const string& which, const string& player, const imdb& db, bool suggest)
+{
+  string message = which + " specified actor doesn't exist in database!!\n";
+  if(!suggest) return message;
+  vector<string_view> suggestions = db.getClosestActors(player, kMaxSuggestionDistance, kMaxSuggestions);
+  if(suggestions.empty()) suggestions = db.getActorsWithPrefix(player, kMaxSuggestions);
+  if(suggestions.empty()) return message;
+
+  message += "Did you mean:\n";
+  for(string_view suggestion: suggestions) message += "  " + string(suggestion) + "\n";
+  return message;
+}
+
+/**
+ * Checks that both actors exist and differ, returning the message the search
+ * command prints if they don't (and an empty string if they do).  Suggestions
+ * for a misspelled actor are only worth building the name index for in a
+ * long-running server, so the one-shot command goes without.
+ */
+static string validateQuery(const string& actor1, const string& actor2, const imdb& db, bool suggest = false)
+{
+  span<const int> movies;
+  if(!db.getCredits(actor1, movies)) return missingActorMessage("First", actor1, db, suggest);
+  if(!db.getCredits(actor2, movies)) return missingActorMessage("Second", actor2, db, suggest);
+  if(actor1 == actor2) return "Two actors names can not be the same!! \n";
+  return "";
+}
+
+static string formatPath(const path& pth)
+{
+  if(!pth.getLength()) return "The path between the two actors doesn't exist!\n";
+  ostringstream out;
+  out << pth;
+  return out.str();
+}
+
+/**
+ * True if the table can answer the query, i.e. one of the two actors is its source.
+ */
+static bool coveredByTable(const string& actor1, const string& actor2, const distanceTable *table)
+{
+  return table != nullptr && (table->getSource() == actor1 || table->getSource() == actor2);
+}
+
+/**
+ * True if the search should run from actor2 rather than actor1: from the actor
+ * with fewer credits, so the first levels stay small.  The path then needs to
+ * be flipped back.
+ */
+static bool searchFromSecond(const string& actor1, const string& actor2, const imdb& db)
+{
+  span<const int> actor1_movies, actor2_movies;
+  db.getCredits(actor1, actor1_movies);
+  db.getCredits(actor2, actor2_movies);
+  return actor1_movies.size() > actor2_movies.size();
+}
+
+string answerQuery(const string& actor1, const string& actor2, SearchEngine engine, const imdb& db,
+                   const distanceTable *table)
+{
+  string error = validateQuery(actor1, actor2, db);
+  if(!error.empty()) return error;
+
+  if(coveredByTable(actor1, actor2, table))
+  {
+    bool flip = (table->getSource() == actor2);
+    path pth = table->getPath(flip ? actor1 : actor2);
+    if(flip) pth.reverse();
+    return formatPath(pth);
+  }
+
+  bool flip = searchFromSecond(actor1, actor2, db);
+  path pth = flip ? engine(actor2, actor1, db) : engine(actor1, actor2, db);
+  if(flip) pth.reverse();
+  return formatPath(pth);
+}
+
+SearchServer::SearchServer(const imdb& db, SearchEngine engine, size_t numWorkers, const distanceTable *table) :
+  db(db), engine(engine), table(table), pool(numWorkers) {}
+
+vector<string> SearchServer::answerBatch(const vector<Query>& queries)
+{
+  vector<string> answers(queries.size());
+
+  // a shared tree is a one-sided breadth-first search, so only the bfs engine's
+  // queries are grouped: by the actor answerQuery would search from, so each
+  // answer comes out exactly as answerQuery gives it
+  bool shareTrees = (engine == getShortestPathBetweenActors);
+  map<string, vector<size_t>> groups;
+  vector<bool> flipped(queries.size());
+  for(size_t i = 0; i < queries.size(); i++)
+  {
+    answers[i] = validateQuery(queries[i].first, queries[i].second, db, true);
+    if(!answers[i].empty()) continue;
+    // table lookups cost a step per movie in the path, no need to hand them to the pool
+    if(coveredByTable(queries[i].first, queries[i].second, table))
+    {
+      answers[i] = answerQuery(queries[i].first, queries[i].second, engine, db, table);
+      continue;
+    }
+    if(!shareTrees)
+    {
+      pool.schedule([this, &queries, &answers, i] {
+        answers[i] = answerQuery(queries[i].first, queries[i].second, engine, db);
+      });
+      continue;
+    }
+    flipped[i] = searchFromSecond(queries[i].first, queries[i].second, db);
+    groups[flipped[i] ? queries[i].second : queries[i].first].push_back(i);
+  }
+
+  for(const auto& [source, indices]: groups)
+  {
+    if(indices.size() == 1)
+    {
+      size_t i = indices.front();
+      pool.schedule([this, &queries, &answers, i] {
+        answers[i] = answerQuery(queries[i].first, queries[i].second, engine, db);
+      });
+      continue;
+    }
+    pool.schedule([this, &queries, &answers, &flipped, &source, &indices] {
+      vector<string> targets;
+      for(size_t i: indices) targets.push_back(flipped[i] ? queries[i].first : queries[i].second);
+      vector<path> paths = getShortestPathsFromActor(source, targets, db);
+      for(size_t j = 0; j < indices.size(); j++)
+      {
+        if(flipped[indices[j]]) paths[j].reverse();
+        answers[indices[j]] = formatPath(paths[j]);
+      }
+    });
+  }
+  pool.wait();
+  return answers;
+}
+
+void SearchServer::serve(istream& in, ostream& out)
+{
+  vector<Query> batch;
+  string line;
+  while(true)
+  {
+    bool more = (bool) getline(in, line);
+    if(more && !line.empty())
+    {
+      size_t tab = line.find('\t');
+      if(tab == string::npos) batch.push_back({line, ""});
+      else batch.push_back({line.substr(0, tab), line.substr(tab + 1)});
+      continue;
+    }
+    for(const string& answer: answerBatch(batch)) out << answer << "\n";
+    out.flush();
+    batch.clear();
+    if(!more) break;
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "distance-table.h"
+#include "imdb.h"
+#include "six-degrees.h"
+#include "thread-pool.h"
+
+/**
+ * Function: answerQuery
+ * ---------------------
+ * Runs one six-degrees query and returns exactly what the one-shot search
+ * command prints for it: either the path, or a message explaining why there
+ * isn't one (unknown actor, same actor twice, or no connection at all).  If a
+ * distance table is supplied and either actor is its source, the path is read
+ * straight out of the table instead of searched for.
+ */
+std::string answerQuery(const std::string& actor1, const std::string& actor2, SearchEngine engine, const imdb& db,
+                        const distanceTable *table = nullptr);
+
+/**
+ * Class: SearchServer
+ * -------------------
+ * Long-running front end for search.  It keeps a single imdb (and its graph
+ * index, if one is loaded) hot for its whole lifetime, and answers batches of
+ * queries concurrently on a thread pool, each with the engine it was given.
+ * With the one-sided bfs engine, queries within a batch that search from the
+ * same actor are answered off a single breadth-first tree rather than one
+ * search each; other engines answer every query on its own.  Queries touching
+ * the source of the (optional) distance table aren't searched at all.
+ *
+ * serve speaks a line-oriented protocol: each line holds one query, the two actor
+ * names separated by a tab.  An empty line, or the end of the input, closes the
+ * current batch.  Answers are written in the same order as the queries, each
+ * followed by an empty line, and the output is flushed after every batch.
+ */
+class SearchServer {
+ public:
+  using Query = std::pair<std::string, std::string>;
+
+  SearchServer(const imdb& db, SearchEngine engine, size_t numWorkers, const distanceTable *table = nullptr);
+
+/**
+ * Method: answerBatch
+ * -------------------
+ * Answers every query in the batch and returns the answers in query order,
+ * each formatted as answerQuery would, except that an unknown actor's message
+ * is followed by a list of the closest names in the database.
+ */
+  std::vector<std::string> answerBatch(const std::vector<Query>& queries);
+
+/**
+ * Method: serve
+ * -------------
+ * Reads batches from in and writes their answers to out until in is exhausted.
+ */
+  void serve(std::istream& in, std::ostream& out);
+
+ private:
+  const imdb& db;
+  SearchEngine engine;
+  const distanceTable *table;
+  ThreadPool pool;
+
+  SearchServer(const SearchServer& original) = delete;
+  SearchServer& operator=(const SearchServer& rhs) = delete;
+};
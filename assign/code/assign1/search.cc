@@ -1,133 +1,158 @@
-#include <vector>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
-#include <queue>
-#include <unordered_map>
-#include <unordered_set>
-#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "distance-table.h"
 #include "imdb.h"
-#include "path.h"
+#include "search-server.h"
+#include "six-degrees.h"
 using namespace std;
 
-struct ConnectionHash
-{
-  std::size_t operator()(const path::connection& cn)const
-  {
-    const std::hash<std::string> hs; 
-    return hs(cn.movie.title) ^ cn.movie.year ^ hs(cn.player);
-  }
-};
+static const int kDatabaseNotFound = 2;
 
+static void printUsage(const char *progname)
+{
+  std::cout << "Usage: " << progname << " [-d <table-file>] [-e " << kSearchEngineNames << "] [-m <map-options>] [-n] [-t <threads>] <actor1> <actor2>\n";
+  std::cout << "       " << progname << " -s [-d <table-file>] [-e " << kSearchEngineNames << "] [-m <map-options>] [-n] [-w <workers>]\n";
+  std::cout << "       " << progname << " -o <table-file> [-m <map-options>] [-n] <actor>\n";
+  std::cout << "  -d  answer queries involving the source of this distance table from the table\n";
+  std::cout << "  -e  search engine to use (default bidirectional)\n";
+  std::cout << "  -t  number of threads the parallel engine expands each level with (default: hardware\n";
+  std::cout << "      threads, shared out among the workers in server mode)\n";
+  std::cout << "  -m  comma-separated populate,lock,random,sequential: how to map the data files\n";
+  std::cout << "  -n  don't use the graph index, even if build-index has written one\n";
+  std::cout << "  -o  run one search from <actor> to everyone, and write the distance table to this file\n";
+  std::cout << "  -s  serve batches of tab-separated actor pairs read from stdin\n";
+  std::cout << "  -w  number of worker threads answering queries in server mode\n";
+}
 
-struct ConnectionEqual
+/**
+ * Single-source mode: one search from source to everyone, saved as a distance
+ * table, followed by how many actors sit at each distance.
+ */
+static int writeDistanceTable(const string& source, const string& fileName, const imdb& db)
 {
-  bool operator()(const path::connection& cn1, const path::connection& cn2)const
+  if(db.getActorId(source) == -1)
   {
-    return cn1.movie == cn2.movie && cn1.player == cn2.player;
+    std::cout << "Specified actor doesn't exist in database!!\n";
+    return 0;
   }
-};
-
-struct FilmHash
-{
-  std::size_t operator()(const film& f)const
+  if(!distanceTable::write(source, db, fileName))
   {
-    const std::hash<std::string> hs; 
-    return hs(f.title) ^ f.year;
+    std::cout << "Couldn't write the distance table to " << fileName << "\n";
+    return 0;
   }
-};
 
-path create_path(const string& actor1, path::connection &last_connection, unordered_map<path::connection, path::connection, ConnectionHash, ConnectionEqual> &parent)
-{
-  path pth(last_connection.player);
-  
-  while(last_connection.player != actor1)
+  distanceTable table(fileName, db);
+  std::cout << table.getReachedCount() << " of " << db.getActorCount() << " actors are connected to " << source << ":\n";
+  vector<int> counts = table.getDistanceCounts();
+  for(size_t distance = 0; distance < counts.size(); distance++)
   {
-    path::connection next_connection = parent[last_connection];
-    pth.addConnection(last_connection.movie, next_connection.player);
-    last_connection = std::move(next_connection);
+    std::cout << "  distance " << distance << ": " << counts[distance] << "\n";
   }
-  pth.reverse();
-  return pth;
+  return 0;
 }
 
-path getShortestPathBetweenActors(const string& actor1, const string& actor2, const imdb& db)
-{
-  unordered_set<film, FilmHash> visited_movies;
-  unordered_set<string> visited_actors;
-  unordered_map<path::connection, path::connection, ConnectionHash, ConnectionEqual> parent;
-  queue<path::connection> paths_queue;
-  paths_queue.push(path::connection(film(), actor1));
-  visited_actors.insert(actor1);
-  while(!paths_queue.empty())
+int main(int argc, char *argv[]) {
+  SearchEngine engine = getShortestPathBidirectional;
+  bool useGraphIndex = true;
+  int mapOptions = imdb::kMapDefault;
+  const char *tableFileName = nullptr;
+  const char *outputTableFileName = nullptr;
+  bool serverMode = false;
+  size_t searchThreads = 0;
+  size_t numWorkers = max(1u, thread::hardware_concurrency());
+  int opt;
+  while((opt = getopt(argc, argv, "d:e:m:no:st:w:")) != -1)
   {
-    auto q_conn = paths_queue.front();
-    paths_queue.pop();
-    if(q_conn.player == actor2)
+    switch(opt)
     {
-      return create_path(actor1, q_conn, parent);
+    case 'd':
+      tableFileName = optarg;
+      break;
+    case 'e':
+      engine = getSearchEngine(optarg);
+      break;
+    case 'm':
+      if(!imdb::parseMapOptions(optarg, mapOptions)) engine = nullptr;
+      break;
+    case 'n':
+      useGraphIndex = false;
+      break;
+    case 'o':
+      outputTableFileName = optarg;
+      break;
+    case 's':
+      serverMode = true;
+      break;
+    case 't':
+      if(atoi(optarg) <= 0) engine = nullptr;
+      else searchThreads = atoi(optarg);
+      break;
+    case 'w':
+      numWorkers = atoi(optarg);
+      break;
+    default:
+      engine = nullptr;
     }
-    vector<film> last_actor_movies{};
-    db.getCredits(q_conn.player, last_actor_movies);
-    for(const film& movie: last_actor_movies)
+    if(engine == nullptr || numWorkers == 0)
     {
-      if(visited_movies.find(movie) == visited_movies.end())
-      {
-        visited_movies.insert(movie);
-        vector<string> movie_actors{};
-        db.getCast(movie, movie_actors);
-        for(const string& actor: movie_actors)
-        {
-          if(visited_actors.find(actor) == visited_actors.end())
-          {
-            visited_actors.insert(actor);
-            path::connection cn(movie, actor);
-            paths_queue.push(cn);
-            parent[cn] = q_conn;
-          }
-        }
-      }
+      printUsage(argv[0]);
+      return 0;
     }
   }
-  return path(actor1);
-}
-
-int main(int argc, char *argv[]) {
-  if(argc != 3) 
+  if(outputTableFileName != nullptr)
   {
-    std::cout << "You must specify 2 actors!!\n";
-    return 0;
+    if(serverMode || argc - optind != 1)
+    {
+      printUsage(argv[0]);
+      return 0;
+    }
   }
-  string actor1(argv[1]);
-  string actor2(argv[2]);
-  imdb db(kIMDBDataDirectory);
-  vector<film> actor1_movies;
-  vector<film> actor2_movies;
-  if(!db.getCredits(actor1, actor1_movies))
+  else if(!serverMode && argc - optind != 2) 
   {
-    std::cout << "First specified actor doesn't exist in database!!\n";
+    std::cout << "You must specify 2 actors!!\n";
+    printUsage(argv[0]);
     return 0;
   }
-  if(!db.getCredits(actor2, actor2_movies))
+
+  // every server worker may run a parallel search at once, so unless told
+  // otherwise they split the hardware threads instead of each taking them all
+  if(searchThreads == 0 && serverMode) searchThreads = max<size_t>(1, thread::hardware_concurrency() / numWorkers);
+  if(searchThreads != 0) setParallelSearchThreads(searchThreads);
+
+  imdb db(kIMDBDataDirectory, mapOptions);
+  if(!db.good())
   {
-    std::cout << "Second specified actor doesn't exist in database!!\n";
-    return 0;
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
   }
-  if(actor1 == actor2)
+  if(useGraphIndex) db.loadGraphIndex();
+  if(outputTableFileName != nullptr)
   {
-    std::cout << "Two actors names can not be the same!! \n";
-    return 0;
+    return writeDistanceTable(argv[optind], outputTableFileName, db);
   }
-  string& a1 = (actor1_movies.size() <= actor2_movies.size()) ? actor1 : actor2;
-  string& a2 = (actor1_movies.size() <= actor2_movies.size()) ? actor2 : actor1;
-  bool flip = (actor1_movies.size() > actor2_movies.size());
-  path pth = getShortestPathBetweenActors(a1, a2, db);
-  if(flip) pth.reverse();
-  if(!pth.getLength())
+
+  unique_ptr<distanceTable> table;
+  if(tableFileName != nullptr)
   {
-    std::cout << "The path between the two actors doesn't exist!\n";
-  }else
+    table.reset(new distanceTable(tableFileName, db));
+    if(!table->good())
+    {
+      std::cout << "Couldn't load a distance table for this database from " << tableFileName << "\n";
+      return 0;
+    }
+  }
+  if(serverMode)
   {
-    std::cout << pth;
+    SearchServer server(db, engine, numWorkers, table.get());
+    server.serve(cin, cout);
+    return 0;
   }
-  
+
+  std::cout << answerQuery(argv[optind], argv[optind + 1], engine, db, table.get());
   return 0;
 }
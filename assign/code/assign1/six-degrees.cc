@@ -0,0 +1,507 @@
+#include <vector>
+#include <queue>
+#include <memory>
+#include <atomic>
+#include <barrier>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <span>
+#include <string>
+#include <string_view>
+#include "six-degrees.h"
+using namespace std;
+
+/**
+ * The engines below are written once against a tiny graph interface and
+ * instantiated for two graph adapters:
+ *
+ *   offsetGraph: nodes are record offsets in the mapped data files.  Always
+ *                available.  Records are padded to multiples of four bytes, so
+ *                offset / 4 is a unique key for each node.
+ *   indexGraph:  nodes are the dense ids of the graph index written by
+ *                build-index.  Adjacency is a flat int array, so expansion
+ *                never touches the variable-length records at all.
+ *
+ * Both expose findActor (node or -1), getCredits/getCast (spans of adjacent
+ * nodes), actorKey/movieKey with getActorKeyCount/getMovieKeyCount for sizing
+ * flat arrays, getActorName/getMovie for rebuilding the final path, and
+ * actorNode/movieNode for going from a dense id back to a node.
+ */
+class offsetGraph
+{
+ public:
+  offsetGraph(const imdb& db) : db(db) {}
+  int findActor(string_view player) const { return db.getActorOffset(player); }
+  span<const int> getCredits(int actor) const { return db.getCreditOffsets(actor); }
+  span<const int> getCast(int movie) const { return db.getCastOffsets(movie); }
+  static size_t actorKey(int actor) { return actor / sizeof(int); }
+  static size_t movieKey(int movie) { return movie / sizeof(int); }
+  size_t getActorKeyCount() const { return db.getActorSlotCount(); }
+  size_t getMovieKeyCount() const { return db.getMovieSlotCount(); }
+  string getActorName(int actor) const { return db.getActorFromOffset(actor); }
+  film getMovie(int movie) const { return db.getMovieFromOffset(movie); }
+  int actorNode(int actor_id) const { return db.getActorOffsetFromId(actor_id); }
+  int movieNode(int movie_id) const { return db.getMovieOffsetFromId(movie_id); }
+
+ private:
+  const imdb& db;
+};
+
+class indexGraph
+{
+ public:
+  indexGraph(const imdb& db) : db(db) {}
+  int findActor(string_view player) const { return db.getActorId(player); }
+  span<const int> getCredits(int actor) const { return db.getCreditIds(actor); }
+  span<const int> getCast(int movie) const { return db.getCastIds(movie); }
+  static size_t actorKey(int actor) { return actor; }
+  static size_t movieKey(int movie) { return movie; }
+  size_t getActorKeyCount() const { return db.getActorCount(); }
+  size_t getMovieKeyCount() const { return db.getMovieCount(); }
+  string getActorName(int actor) const { return db.getActorFromOffset(db.getActorOffsetFromId(actor)); }
+  film getMovie(int movie) const { return db.getMovieFromOffset(db.getMovieOffsetFromId(movie)); }
+  static int actorNode(int actor_id) { return actor_id; }
+  static int movieNode(int movie_id) { return movie_id; }
+
+ private:
+  const imdb& db;
+};
+
+/**
+ * Per-search bookkeeping, indexed by the graph's actor and movie keys.  The
+ * parent and depth arrays are deliberately left uninitialized (so untouched
+ * pages are never faulted in); an entry is only read once its visited bit is set.
+ */
+template <typename Graph>
+struct SearchTree
+{
+  const Graph& graph;
+  vector<bool> visited_actors;
+  vector<bool> visited_movies;
+  unique_ptr<int[]> parent_actor; // actor node we came from
+  unique_ptr<int[]> parent_movie; // movie node connecting the two
+  unique_ptr<int[]> depth;
+
+  SearchTree(const Graph& graph) : graph(graph),
+    visited_actors(graph.getActorKeyCount()), visited_movies(graph.getMovieKeyCount()),
+    parent_actor(new int[graph.getActorKeyCount()]), parent_movie(new int[graph.getActorKeyCount()]),
+    depth(new int[graph.getActorKeyCount()]) {}
+
+  bool hasActor(int actor) const { return visited_actors[Graph::actorKey(actor)]; }
+  int getDepth(int actor) const { return depth[Graph::actorKey(actor)]; }
+
+  // marks the movie visited, returns false if it already was
+  bool visitMovie(int movie)
+  {
+    size_t key = Graph::movieKey(movie);
+    if(visited_movies[key]) return false;
+    visited_movies[key] = true;
+    return true;
+  }
+
+  void visitActor(int actor, int movie, int from_actor, int actor_depth)
+  {
+    size_t key = Graph::actorKey(actor);
+    visited_actors[key] = true;
+    parent_actor[key] = from_actor;
+    parent_movie[key] = movie;
+    depth[key] = actor_depth;
+  }
+
+  /**
+   * Appends to pth the connections leading from actor up to the root of the
+   * tree, converting nodes back into names only now.
+   */
+  void appendPathToRoot(int actor, int root, path& pth) const
+  {
+    while(actor != root)
+    {
+      size_t key = Graph::actorKey(actor);
+      pth.addConnection(graph.getMovie(parent_movie[key]), graph.getActorName(parent_actor[key]));
+      actor = parent_actor[key];
+    }
+  }
+};
+
+template <typename Graph>
+static path breadthFirstSearch(const Graph& graph, const string& actor1, const string& actor2)
+{
+  int source = graph.findActor(actor1);
+  int target = graph.findActor(actor2);
+  if(source == -1 || target == -1) return path(actor1);
+
+  SearchTree<Graph> tree(graph);
+  queue<int> actors_queue;
+  actors_queue.push(source);
+  tree.visitActor(source, -1, -1, 0);
+  while(!actors_queue.empty())
+  {
+    int player = actors_queue.front();
+    actors_queue.pop();
+    if(player == target)
+    {
+      path pth(actor2);
+      tree.appendPathToRoot(target, source, pth);
+      pth.reverse();
+      return pth;
+    }
+    for(int movie: graph.getCredits(player))
+    {
+      if(!tree.visitMovie(movie)) continue;
+      for(int actor: graph.getCast(movie))
+      {
+        if(tree.hasActor(actor)) continue;
+        tree.visitActor(actor, movie, player, tree.getDepth(player) + 1);
+        actors_queue.push(actor);
+      }
+    }
+  }
+  return path(actor1);
+}
+
+template <typename Graph>
+static vector<path> breadthFirstSearchTree(const Graph& graph, const string& source_name, const vector<string>& target_names)
+{
+  vector<path> paths(target_names.size(), path(source_name));
+  int source = graph.findActor(source_name);
+  if(source == -1) return paths;
+
+  SearchTree<Graph> tree(graph);
+  // a target may appear more than once, so count the distinct actors still to reach
+  vector<int> targets;
+  vector<bool> is_target(graph.getActorKeyCount());
+  size_t nof_unreached = 0;
+  for(const string& target_name: target_names)
+  {
+    int target = graph.findActor(target_name);
+    targets.push_back(target);
+    if(target == -1 || is_target[Graph::actorKey(target)]) continue;
+    is_target[Graph::actorKey(target)] = true;
+    nof_unreached++;
+  }
+
+  queue<int> actors_queue;
+  actors_queue.push(source);
+  tree.visitActor(source, -1, -1, 0);
+  if(is_target[Graph::actorKey(source)]) nof_unreached--;
+  while(!actors_queue.empty() && nof_unreached > 0)
+  {
+    int player = actors_queue.front();
+    actors_queue.pop();
+    for(int movie: graph.getCredits(player))
+    {
+      if(!tree.visitMovie(movie)) continue;
+      for(int actor: graph.getCast(movie))
+      {
+        if(tree.hasActor(actor)) continue;
+        tree.visitActor(actor, movie, player, tree.getDepth(player) + 1);
+        actors_queue.push(actor);
+        if(is_target[Graph::actorKey(actor)]) nof_unreached--;
+      }
+    }
+  }
+
+  for(size_t i = 0; i < targets.size(); i++)
+  {
+    if(targets[i] == -1 || targets[i] == source || !tree.hasActor(targets[i])) continue;
+    path pth(target_names[i]);
+    tree.appendPathToRoot(targets[i], source, pth);
+    pth.reverse();
+    paths[i] = pth;
+  }
+  return paths;
+}
+
+/**
+ * Grows the tree from source until the graph is exhausted, then translates it
+ * from graph nodes into the dense actor and movie ids the caller sees.
+ */
+template <typename Graph>
+static bool breadthFirstSearchAll(const Graph& graph, const imdb& db, const string& source_name, vector<int>& distances,
+                                  vector<int>& parent_actors, vector<int>& parent_movies)
+{
+  int source = graph.findActor(source_name);
+  if(source == -1) return false;
+
+  SearchTree<Graph> tree(graph);
+  queue<int> actors_queue;
+  actors_queue.push(source);
+  tree.visitActor(source, -1, -1, 0);
+  while(!actors_queue.empty())
+  {
+    int player = actors_queue.front();
+    actors_queue.pop();
+    for(int movie: graph.getCredits(player))
+    {
+      if(!tree.visitMovie(movie)) continue;
+      for(int actor: graph.getCast(movie))
+      {
+        if(tree.hasActor(actor)) continue;
+        tree.visitActor(actor, movie, player, tree.getDepth(player) + 1);
+        actors_queue.push(actor);
+      }
+    }
+  }
+
+  vector<int> actor_ids(graph.getActorKeyCount(), -1), movie_ids(graph.getMovieKeyCount(), -1);
+  for(int id = 0; id < db.getActorCount(); id++) actor_ids[Graph::actorKey(graph.actorNode(id))] = id;
+  for(int id = 0; id < db.getMovieCount(); id++) movie_ids[Graph::movieKey(graph.movieNode(id))] = id;
+  distances.assign(db.getActorCount(), -1);
+  parent_actors.assign(db.getActorCount(), -1);
+  parent_movies.assign(db.getActorCount(), -1);
+  for(int id = 0; id < db.getActorCount(); id++)
+  {
+    int actor = graph.actorNode(id);
+    if(!tree.hasActor(actor)) continue;
+    size_t key = Graph::actorKey(actor);
+    distances[id] = tree.depth[key];
+    if(actor == source) continue;
+    parent_actors[id] = actor_ids[Graph::actorKey(tree.parent_actor[key])];
+    parent_movies[id] = movie_ids[Graph::movieKey(tree.parent_movie[key])];
+  }
+  return true;
+}
+
+/**
+ * Bidirectional search state for one side of the search: the tree grown from
+ * the side's root actor and the actors discovered at the deepest level.
+ */
+template <typename Graph>
+struct SearchSide
+{
+  SearchTree<Graph> tree;
+  vector<int> frontier;
+
+  SearchSide(const Graph& graph, int root) : tree(graph), frontier{root}
+  {
+    tree.visitActor(root, -1, -1, 0);
+  }
+};
+
+/**
+ * Expands every actor in the side's frontier by one level.  Newly discovered
+ * actors that the other side has already reached are meeting points, and the
+ * one giving the shortest total path is stored in meeting_actor.  Returns the
+ * total length of that path, or -1 if the two sides haven't met yet.
+ */
+template <typename Graph>
+static int expandFrontier(const Graph& graph, SearchSide<Graph>& side, const SearchSide<Graph>& other, int& meeting_actor)
+{
+  int best_length = -1;
+  vector<int> next_frontier;
+  for(int player: side.frontier)
+  {
+    int player_depth = side.tree.getDepth(player);
+    for(int movie: graph.getCredits(player))
+    {
+      if(!side.tree.visitMovie(movie)) continue;
+      for(int actor: graph.getCast(movie))
+      {
+        if(side.tree.hasActor(actor)) continue;
+        side.tree.visitActor(actor, movie, player, player_depth + 1);
+        next_frontier.push_back(actor);
+        if(other.tree.hasActor(actor))
+        {
+          int length = player_depth + 1 + other.tree.getDepth(actor);
+          if(best_length == -1 || length < best_length)
+          {
+            best_length = length;
+            meeting_actor = actor;
+          }
+        }
+      }
+    }
+  }
+  side.frontier = std::move(next_frontier);
+  return best_length;
+}
+
+template <typename Graph>
+static path bidirectionalSearch(const Graph& graph, const string& actor1, const string& actor2)
+{
+  int source = graph.findActor(actor1);
+  int target = graph.findActor(actor2);
+  // the two trees only meet on newly discovered actors, so they'd never meet at a shared root
+  if(source == -1 || target == -1 || source == target) return path(actor1);
+
+  SearchSide<Graph> forward(graph, source), backward(graph, target);
+  int meeting_actor = -1;
+  while(!forward.frontier.empty() && !backward.frontier.empty())
+  {
+    // always grow the smaller frontier, it costs fewer getCredits/getCast calls
+    int length = (forward.frontier.size() <= backward.frontier.size()) ?
+      expandFrontier(graph, forward, backward, meeting_actor) :
+      expandFrontier(graph, backward, forward, meeting_actor);
+    if(length != -1) break;
+  }
+  if(meeting_actor == -1) return path(actor1);
+
+  // walk from the meeting actor back to actor1, then forward to actor2
+  path pth(graph.getActorName(meeting_actor));
+  forward.tree.appendPathToRoot(meeting_actor, source, pth);
+  pth.reverse();
+  backward.tree.appendPathToRoot(meeting_actor, target, pth);
+  return pth;
+}
+
+/**
+ * Fixed-size bitmap whose bits can be claimed concurrently: testAndSet sets a
+ * bit and reports whether it was already set, so exactly one thread wins each
+ * bit.  Relaxed ordering is enough, since whatever the winner writes alongside
+ * the bit is only read once the level's barrier has been passed.
+ */
+class AtomicBitmap
+{
+ public:
+  AtomicBitmap(size_t size) : words((size + kBitsPerWord - 1) / kBitsPerWord) {}
+  bool test(size_t bit) const
+  {
+    return words[bit / kBitsPerWord].load(memory_order_relaxed) & mask(bit);
+  }
+  bool testAndSet(size_t bit)
+  {
+    return words[bit / kBitsPerWord].fetch_or(mask(bit), memory_order_relaxed) & mask(bit);
+  }
+
+ private:
+  static const size_t kBitsPerWord = 64;
+  static uint64_t mask(size_t bit) { return uint64_t(1) << (bit % kBitsPerWord); }
+  vector<atomic<uint64_t>> words;
+};
+
+static size_t parallelSearchThreads = max(1u, thread::hardware_concurrency());
+
+void setParallelSearchThreads(size_t numThreads)
+{
+  parallelSearchThreads = max<size_t>(1, numThreads);
+}
+
+template <typename Graph>
+static path parallelBreadthFirstSearch(const Graph& graph, const string& actor1, const string& actor2)
+{
+  int source = graph.findActor(actor1);
+  int target = graph.findActor(actor2);
+  if(source == -1 || target == -1) return path(actor1);
+
+  // parent entries are written only by the thread that claimed the actor's bit
+  AtomicBitmap visited_actors(graph.getActorKeyCount());
+  AtomicBitmap visited_movies(graph.getMovieKeyCount());
+  unique_ptr<int[]> parent_actor(new int[graph.getActorKeyCount()]);
+  unique_ptr<int[]> parent_movie(new int[graph.getActorKeyCount()]);
+  visited_actors.testAndSet(Graph::actorKey(source));
+
+  // frontier actors are handed out in chunks, since degrees vary wildly
+  const size_t kChunkSize = 64;
+  vector<int> frontier{source};
+  atomic<bool> found(source == target);
+  atomic<size_t> next_chunk(0);
+  bool done = found;
+
+  // the workers live for the whole search; the barrier closes each level, and
+  // its completion step (run by one thread while the others wait) gathers the
+  // next frontier and decides whether there's another level to expand
+  size_t nof_threads = parallelSearchThreads;
+  vector<vector<int>> next_frontiers(nof_threads);
+  auto finish_level = [&]() noexcept {
+    frontier.clear();
+    for(vector<int>& next_frontier: next_frontiers)
+    {
+      frontier.insert(frontier.end(), next_frontier.begin(), next_frontier.end());
+      next_frontier.clear();
+    }
+    next_chunk = 0;
+    done = frontier.empty() || found;
+  };
+  barrier level_done(nof_threads, finish_level);
+
+  auto expand = [&](size_t thread_idx) {
+    vector<int>& next_frontier = next_frontiers[thread_idx];
+    while(!done)
+    {
+      size_t begin;
+      while(!found && (begin = next_chunk.fetch_add(kChunkSize)) < frontier.size())
+      {
+        size_t end = min(begin + kChunkSize, frontier.size());
+        for(size_t i = begin; i < end; i++)
+        {
+          int player = frontier[i];
+          for(int movie: graph.getCredits(player))
+          {
+            if(visited_movies.testAndSet(Graph::movieKey(movie))) continue;
+            for(int actor: graph.getCast(movie))
+            {
+              size_t key = Graph::actorKey(actor);
+              if(visited_actors.test(key) || visited_actors.testAndSet(key)) continue;
+              parent_actor[key] = player;
+              parent_movie[key] = movie;
+              next_frontier.push_back(actor);
+              if(actor == target) found = true;
+            }
+          }
+        }
+      }
+      level_done.arrive_and_wait();
+    }
+  };
+
+  if(!done)
+  {
+    vector<thread> workers;
+    for(size_t thread_idx = 1; thread_idx < nof_threads; thread_idx++) workers.emplace_back(expand, thread_idx);
+    expand(0);
+    for(thread& worker: workers) worker.join();
+  }
+  if(!found || source == target) return path(actor1);
+
+  path pth(actor2);
+  for(int actor = target; actor != source; )
+  {
+    size_t key = Graph::actorKey(actor);
+    pth.addConnection(graph.getMovie(parent_movie[key]), graph.getActorName(parent_actor[key]));
+    actor = parent_actor[key];
+  }
+  pth.reverse();
+  return pth;
+}
+
+path getShortestPathBetweenActors(const string& actor1, const string& actor2, const imdb& db)
+{
+  if(db.hasGraphIndex()) return breadthFirstSearch(indexGraph(db), actor1, actor2);
+  return breadthFirstSearch(offsetGraph(db), actor1, actor2);
+}
+
+path getShortestPathBidirectional(const string& actor1, const string& actor2, const imdb& db)
+{
+  if(db.hasGraphIndex()) return bidirectionalSearch(indexGraph(db), actor1, actor2);
+  return bidirectionalSearch(offsetGraph(db), actor1, actor2);
+}
+
+path getShortestPathParallel(const string& actor1, const string& actor2, const imdb& db)
+{
+  if(db.hasGraphIndex()) return parallelBreadthFirstSearch(indexGraph(db), actor1, actor2);
+  return parallelBreadthFirstSearch(offsetGraph(db), actor1, actor2);
+}
+
+vector<path> getShortestPathsFromActor(const string& source, const vector<string>& targets, const imdb& db)
+{
+  if(db.hasGraphIndex()) return breadthFirstSearchTree(indexGraph(db), source, targets);
+  return breadthFirstSearchTree(offsetGraph(db), source, targets);
+}
+
+bool getDistancesFromActor(const string& source, const imdb& db, vector<int>& distances,
+                           vector<int>& parent_actors, vector<int>& parent_movies)
+{
+  if(db.hasGraphIndex()) return breadthFirstSearchAll(indexGraph(db), db, source, distances, parent_actors, parent_movies);
+  return breadthFirstSearchAll(offsetGraph(db), db, source, distances, parent_actors, parent_movies);
+}
+
+const char *const kSearchEngineNames = "bfs|bidirectional|parallel";
+
+SearchEngine getSearchEngine(const string& name)
+{
+  if(name == "bfs") return getShortestPathBetweenActors;
+  if(name == "bidirectional") return getShortestPathBidirectional;
+  if(name == "parallel") return getShortestPathParallel;
+  return nullptr;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "imdb.h"
+#include "path.h"
+#include <string>
+#include <vector>
+
+/**
+ * Type: SearchEngine
+ * ------------------
+ * Every six-degrees search engine has the same shape: given two actors known to
+ * be in the imdb, it returns a shortest path from the first to the second, or a
+ * path of length 0 if the two aren't connected.  Engines work straight off the
+ * mapped data files, and switch over to the (much more compact) graph index
+ * automatically if the imdb has one loaded.
+ */
+using SearchEngine = path (*)(const std::string& actor1, const std::string& actor2, const imdb& db);
+
+/**
+ * Function: getShortestPathBetweenActors
+ * --------------------------------------
+ * Classic breadth-first search that grows a single tree from actor1 until it
+ * reaches actor2.
+ */
+path getShortestPathBetweenActors(const std::string& actor1, const std::string& actor2, const imdb& db);
+
+/**
+ * Function: getShortestPathBidirectional
+ * --------------------------------------
+ * Grows one breadth-first tree from each actor, always expanding whichever has
+ * the smaller frontier, and stops at the first level where the two trees meet.
+ * Visits far fewer actors than the one-sided search on long paths.
+ */
+path getShortestPathBidirectional(const std::string& actor1, const std::string& actor2, const imdb& db);
+
+/**
+ * Function: getShortestPathParallel
+ * ---------------------------------
+ * Level-synchronous breadth-first search from actor1: every level's frontier is
+ * carved up among worker threads, which claim actors and movies through shared
+ * atomic bitmaps and collect the next level in private buffers.  Returns a path
+ * of the same (shortest) length as the serial engines, though possibly through
+ * different movies.  Pays off on the hard queries that touch most of the graph.
+ */
+path getShortestPathParallel(const std::string& actor1, const std::string& actor2, const imdb& db);
+
+/**
+ * Function: setParallelSearchThreads
+ * ----------------------------------
+ * Sets how many threads getShortestPathParallel expands each level with.
+ * Defaults to the number of hardware threads.
+ */
+void setParallelSearchThreads(size_t numThreads);
+
+/**
+ * Function: getShortestPathsFromActor
+ * -----------------------------------
+ * Answers several queries that share a source actor with a single breadth-first
+ * tree: the search grows from source until every target has been reached (or
+ * the graph is exhausted), and then each path is read straight off the tree.
+ * The returned vector is parallel to targets; unreachable or unknown targets get
+ * a path of length 0.
+ */
+std::vector<path> getShortestPathsFromActor(const std::string& source, const std::vector<std::string>& targets,
+                                            const imdb& db);
+
+/**
+ * Function: getDistancesFromActor
+ * -------------------------------
+ * Runs one breadth-first search from source over the entire graph.  The three
+ * vectors are resized to the number of actors and indexed by actor id (see
+ * imdb::getActorId): distances gets each actor's distance from source, and
+ * parent_actors/parent_movies the actor id and movie id it was first reached
+ * through.  Actors not connected to source get -1 everywhere, as does source's
+ * own parent.  Returns false, leaving the vectors alone, if source isn't in db.
+ */
+bool getDistancesFromActor(const std::string& source, const imdb& db, std::vector<int>& distances,
+                           std::vector<int>& parent_actors, std::vector<int>& parent_movies);
+
+/**
+ * Function: getSearchEngine
+ * -------------------------
+ * Looks up an engine by the name used on the command line ("bfs",
+ * "bidirectional", "parallel"), returning nullptr if there's no such engine.
+ */
+SearchEngine getSearchEngine(const std::string& name);
+
+extern const char *const kSearchEngineNames; // e.g. "bfs|bidirectional|parallel", for usage messages
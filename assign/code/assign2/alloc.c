@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "alloc.h"
+#include "inode.h"
+#include "diskimg.h"
+
+#define NOF_FREE_SLOTS ((int) (sizeof(((struct filsys *) 0)->s_free) / sizeof(uint16_t)))    // 100
+#define NOF_INODE_SLOTS ((int) (sizeof(((struct filsys *) 0)->s_inode) / sizeof(uint16_t)))  // 100
+#define INODE_SCAN_BATCH 64
+
+static int bad_block(struct unixfilesystem *fs, int blockNum) {
+  if (blockNum < INODE_START_SECTOR + fs->superblock.s_isize || blockNum >= fs->superblock.s_fsize) {
+    fprintf(stderr, "alloc: bad block %d\n", blockNum);
+    return 1;
+  }
+  return 0;
+}
+
+static int take_block(struct unixfilesystem *fs) {
+  struct filsys *sb = &fs->superblock;
+  if (sb->s_nfree == 0 || sb->s_nfree > NOF_FREE_SLOTS) {
+    fprintf(stderr, "alloc: bad free count %d\n", sb->s_nfree);
+    return -1;
+  }
+  int blockNum = sb->s_free[--sb->s_nfree];
+  if (blockNum == 0) {
+    // the end of the chain
+    sb->s_nfree++;
+    fprintf(stderr, "alloc: no space\n");
+    return -1;
+  }
+  if (bad_block(fs, blockNum)) {
+    sb->s_nfree++;
+    return -1;
+  }
+  if (sb->s_nfree == 0) {
+    // blockNum holds the next part of the list; load it, then hand the block out
+    uint16_t buf[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+    const uint16_t *list = diskimg_getsector_ptr(fs->dfd, blockNum, buf);
+    if (list == NULL || list[0] > NOF_FREE_SLOTS) {
+      sb->s_nfree++;
+      fprintf(stderr, "alloc: bad free list block %d\n", blockNum);
+      return -1;
+    }
+    sb->s_nfree = list[0];
+    memcpy(sb->s_free, list + 1, sizeof(sb->s_free));
+  }
+  sb->s_fmod = 1;
+  return blockNum;
+}
+
+static int put_block(struct unixfilesystem *fs, int blockNum) {
+  struct filsys *sb = &fs->superblock;
+  if (bad_block(fs, blockNum)) return -1;
+  if (sb->s_nfree == 0) {
+    sb->s_nfree = 1;
+    sb->s_free[0] = 0;
+  }
+  if (sb->s_nfree >= NOF_FREE_SLOTS) {
+    // the superblock's list is full: move it into the block being freed
+    uint16_t list[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+    memset(list, 0, sizeof(list));
+    list[0] = sb->s_nfree;
+    memcpy(list + 1, sb->s_free, sizeof(sb->s_free));
+    if (diskimg_writesector_ordered(fs->dfd, blockNum, list, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+      return -1;
+    }
+    sb->s_nfree = 0;
+  }
+  sb->s_free[sb->s_nfree++] = blockNum;
+  sb->s_fmod = 1;
+  return 0;
+}
+
+static int take_inode(struct unixfilesystem *fs) {
+  struct filsys *sb = &fs->superblock;
+  int numInodes = sb->s_isize * (DISKIMG_SECTOR_SIZE / sizeof(struct inode));
+  while (1) {
+    while (sb->s_ninode > 0 && sb->s_ninode <= NOF_INODE_SLOTS) {
+      int inumber = sb->s_inode[--sb->s_ninode];
+      sb->s_fmod = 1;
+      struct inode in;
+      if (inumber < 1 || inumber > numInodes || inode_iget(fs, inumber, &in) < 0) continue;
+      // the cache of free inodes is only a hint; skip any that got used since
+      if (in.i_mode & IALLOC) continue;
+      // claim it before the lock is let go, or the next refill's scan would
+      // find it still free and hand it out again
+      memset(&in, 0, sizeof(in));
+      in.i_mode = IALLOC;
+      if (inode_iput(fs, inumber, &in) < 0) {
+        sb->s_ninode++;
+        return -1;
+      }
+      return inumber;
+    }
+
+    // refill s_inode from the inode area
+    sb->s_ninode = 0;
+    struct inode inodes[INODE_SCAN_BATCH];
+    for (int first = 1; first <= numInodes && sb->s_ninode < NOF_INODE_SLOTS; first += INODE_SCAN_BATCH) {
+      int count = numInodes - first + 1 < INODE_SCAN_BATCH ? numInodes - first + 1 : INODE_SCAN_BATCH;
+      int fetched = inode_iget_range(fs, first, count, inodes);
+      for (int i = 0; i < fetched && sb->s_ninode < NOF_INODE_SLOTS; i++) {
+        if ((inodes[i].i_mode & IALLOC) == 0) sb->s_inode[sb->s_ninode++] = first + i;
+      }
+      if (fetched < count) break;
+    }
+    if (sb->s_ninode == 0) {
+      fprintf(stderr, "alloc: out of inodes\n");
+      return -1;
+    }
+  }
+}
+
+int alloc_block(struct unixfilesystem *fs) {
+  pthread_mutex_lock(&fs->superblockLock);
+  int blockNum = take_block(fs);
+  pthread_mutex_unlock(&fs->superblockLock);
+  return blockNum;
+}
+
+int alloc_freeblock(struct unixfilesystem *fs, int blockNum) {
+  pthread_mutex_lock(&fs->superblockLock);
+  int err = put_block(fs, blockNum);
+  pthread_mutex_unlock(&fs->superblockLock);
+  return err;
+}
+
+int alloc_inode(struct unixfilesystem *fs) {
+  pthread_mutex_lock(&fs->superblockLock);
+  int inumber = take_inode(fs);
+  pthread_mutex_unlock(&fs->superblockLock);
+  return inumber;
+}
+
+void alloc_freeinode(struct unixfilesystem *fs, int inumber) {
+  struct filsys *sb = &fs->superblock;
+  pthread_mutex_lock(&fs->superblockLock);
+  // like V6, an inode that doesn't fit is simply found again by the next scan
+  if (sb->s_ninode < NOF_INODE_SLOTS) {
+    sb->s_inode[sb->s_ninode++] = inumber;
+    sb->s_fmod = 1;
+  }
+  pthread_mutex_unlock(&fs->superblockLock);
+}
@@ -0,0 +1,51 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include "unixfilesystem.h"
+
+/**
+ * Block and inode allocation, the way Unix V6 did it (alloc.c).
+ *
+ * Free blocks are kept in the superblock's s_free array, up to 100 of them.
+ * s_free[0] names a block that holds the next 100 (preceded by their count),
+ * and so on down a chain that ends with a 0.  Free inodes are cached in
+ * s_inode; when that runs dry, the inode area is scanned for unallocated
+ * inodes to fill it up again.
+ *
+ * The changes are made to fs->superblock, which is marked modified (s_fmod)
+ * and only written out by unixfilesystem_sync.  Every call holds
+ * fs->superblockLock while it works on the free lists, as unixfilesystem_sync
+ * does while it writes them out, and alloc_inode marks the inode it hands out
+ * as allocated before letting go of the lock, so these calls are safe from
+ * several threads.  The rest of the superblock never changes and can be read
+ * without the lock.
+ */
+
+/**
+ * Takes a block off the free list.  Returns its block number, or -1 if the
+ * disk is full or the free list is damaged.  The block's contents are left as
+ * they are.
+ */
+int alloc_block(struct unixfilesystem *fs);
+
+/**
+ * Puts block blockNum back on the free list.  Returns 0 on success, -1 on
+ * error.
+ */
+int alloc_freeblock(struct unixfilesystem *fs, int blockNum);
+
+/**
+ * Finds an unallocated inode and claims it: it is written back with only
+ * IALLOC set (no links, no blocks), for the caller to fill in.  A caller that
+ * ends up not using it clears it and hands it to alloc_freeinode.  Returns
+ * the inumber, or -1 if there's none.
+ */
+int alloc_inode(struct unixfilesystem *fs);
+
+/**
+ * Remembers that inode inumber, which the caller has already cleared, is
+ * free.
+ */
+void alloc_freeinode(struct unixfilesystem *fs, int inumber);
+
+#endif // _ALLOC_H_
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -11,43 +12,213 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 
-int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
-  SHA_CTX shactx;
-  if (!SHA1_Init(&shactx)) {
-    // An error occurred initializing the SHA1 context.
-    return -1;
+// most blocks a single read may fetch while checksumming a file
+#define CHKSUMFILE_RUN_BLOCKS 64
+
+/**
+ * XXH64 with seed 0, fed incrementally.  Input is consumed in 32-byte stripes;
+ * a partial stripe waits in mem for the next update.  The digest is stored
+ * big-endian, the way xxHash prints it.
+ */
+#define XXH_PRIME1 11400714785074694791ULL
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+
+struct xxh64state {
+  uint64_t v[4];
+  uint64_t totalLen;
+  unsigned char mem[32];
+  int memSize;
+};
+
+static uint64_t xxh_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));   // V6 images are little-endian, and so are we
+  return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME2;
+  return xxh_rotl(acc, 31) * XXH_PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+  acc ^= xxh_round(0, v);
+  return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void xxh64_init(struct xxh64state *s) {
+  s->v[0] = XXH_PRIME1 + XXH_PRIME2;
+  s->v[1] = XXH_PRIME2;
+  s->v[2] = 0;
+  s->v[3] = -XXH_PRIME1;
+  s->totalLen = 0;
+  s->memSize = 0;
+}
+
+static void xxh64_stripe(struct xxh64state *s, const unsigned char *p) {
+  for (int i = 0; i < 4; i++) s->v[i] = xxh_round(s->v[i], xxh_read64(p + 8 * i));
+}
+
+static void xxh64_update(struct xxh64state *s, const unsigned char *p, size_t len) {
+  s->totalLen += len;
+  if (s->memSize > 0) {
+    size_t room = 32 - s->memSize;
+    size_t fill = room < len ? room : len;
+    memcpy(s->mem + s->memSize, p, fill);
+    s->memSize += fill;
+    p += fill;
+    len -= fill;
+    if (s->memSize < 32) return;
+    xxh64_stripe(s, s->mem);
+    s->memSize = 0;
+  }
+  for (; len >= 32; p += 32, len -= 32) xxh64_stripe(s, p);
+  memcpy(s->mem, p, len);
+  s->memSize = len;
+}
+
+static void xxh64_final(struct xxh64state *s, unsigned char *digest) {
+  uint64_t h;
+  if (s->totalLen >= 32) {
+    h = xxh_rotl(s->v[0], 1) + xxh_rotl(s->v[1], 7) + xxh_rotl(s->v[2], 12) + xxh_rotl(s->v[3], 18);
+    for (int i = 0; i < 4; i++) h = xxh_merge(h, s->v[i]);
+  } else {
+    h = XXH_PRIME5;
+  }
+  h += s->totalLen;
+
+  const unsigned char *p = s->mem;
+  int len = s->memSize;
+  for (; len >= 8; p += 8, len -= 8) {
+    h ^= xxh_round(0, xxh_read64(p));
+    h = xxh_rotl(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+  }
+  if (len >= 4) {
+    uint32_t k;
+    memcpy(&k, p, sizeof(k));
+    h ^= (uint64_t) k * XXH_PRIME1;
+    h = xxh_rotl(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+    p += 4;
+    len -= 4;
   }
+  for (; len > 0; p++, len--) {
+    h ^= *p * XXH_PRIME5;
+    h = xxh_rotl(h, 11) * XXH_PRIME1;
+  }
+  h ^= h >> 33;
+  h *= XXH_PRIME2;
+  h ^= h >> 29;
+  h *= XXH_PRIME3;
+  h ^= h >> 32;
+
+  for (int i = 0; i < 8; i++) digest[i] = h >> (56 - 8 * i);
+}
+
+/**
+ * The engines.  Those with an OpenSSL name go through EVP, whose digest is
+ * fetched once when the engine is selected; xxh64 is computed here.
+ */
+struct chksumengine {
+  const char *name;
+  const char *evpName;   // NULL for xxh64
+  int size;
+};
+
+static const struct chksumengine engines[] = {
+  { "sha1", "SHA1", 20 },
+  { "sha256", "SHA256", 32 },
+  { "blake2s", "BLAKE2S-256", 32 },
+  { "xxh64", NULL, 8 },
+};
+
+static const struct chksumengine *engine = &engines[0];
+static EVP_MD *engineMD = NULL;          // fetched for the current engine
+static pthread_once_t defaultFetched = PTHREAD_ONCE_INIT;
+
+static void fetch_default_md(void) {
+  if (engineMD == NULL && engine->evpName != NULL) engineMD = EVP_MD_fetch(NULL, engine->evpName, NULL);
+}
+
+int chksumfile_setengine(const char *name) {
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+    if (strcmp(engines[i].name, name) != 0) continue;
+    EVP_MD *md = NULL;
+    if (engines[i].evpName != NULL && (md = EVP_MD_fetch(NULL, engines[i].evpName, NULL)) == NULL) {
+      return -1;
+    }
+    EVP_MD_free(engineMD);
+    engineMD = md;
+    engine = &engines[i];
+    return 0;
+  }
+  return -1;
+}
 
-  struct inode in;
-  int err = inode_iget(fs, inumber, &in);
+int chksumfile_size(void) {
+  return engine->size;
+}
+
+const char *chksumfile_enginename(void) {
+  return engine->name;
+}
+
+int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
+  // the stream fetches the inode once and each indirect block once, and hands
+  // back runs of blocks that are contiguous on disk, one read per run
+  struct filestream stream;
+  int err = file_openstream(fs, inumber, &stream);
   if (err < 0) {
     return err;
   }
 
-  if (!(in.i_mode & IALLOC)) {
+  if (!(stream.in.i_mode & IALLOC)) {
     // The inode isn't allocated, so we can't hash it.
     return -1;
   }
 
-  int size = inode_getsize(&in);
-  for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-    char buf[DISKIMG_SECTOR_SIZE];
-    int bno = offset/DISKIMG_SECTOR_SIZE;
-
-    int bytesMoved = file_getblock(fs, inumber, bno, buf);
-    if (bytesMoved < 0)
-      return -1;
-
-    if (!SHA1_Update(&shactx, buf, bytesMoved))
+  struct xxh64state xxh;
+  EVP_MD_CTX *ctx = NULL;
+  if (engine->evpName == NULL) {
+    xxh64_init(&xxh);
+  } else {
+    pthread_once(&defaultFetched, fetch_default_md);
+    ctx = EVP_MD_CTX_new();
+    if (ctx == NULL || engineMD == NULL || !EVP_DigestInit_ex(ctx, engineMD, NULL)) {
+      // An error occurred initializing the digest context.
+      EVP_MD_CTX_free(ctx);
       return -1;
+    }
   }
 
-  if (!SHA1_Final(chksum, &shactx))
-    return -1;
+  char buf[CHKSUMFILE_RUN_BLOCKS * DISKIMG_SECTOR_SIZE];
+  int bytesMoved;
+  const void *block;
+  while ((bytesMoved = file_readstream(&stream, CHKSUMFILE_RUN_BLOCKS, buf, &block)) > 0) {
+    if (ctx == NULL) {
+      xxh64_update(&xxh, block, bytesMoved);
+    } else if (!EVP_DigestUpdate(ctx, block, bytesMoved)) {
+      bytesMoved = -1;
+      break;
+    }
+  }
 
-  return SHA_DIGEST_LENGTH;
+  if (ctx == NULL) {
+    if (bytesMoved < 0) return -1;
+    xxh64_final(&xxh, chksum);
+    return engine->size;
+  }
+  int ok = bytesMoved == 0 && EVP_DigestFinal_ex(ctx, chksum, NULL);
+  EVP_MD_CTX_free(ctx);
+  return ok ? engine->size : -1;
 }
 
 int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname, void *chksum) {
@@ -62,7 +233,7 @@ int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname, void
 void chksumfile_cvt2string(void *chksum, char *outstring) {
   uint8_t *c = (uint8_t *) chksum;
 
-  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+  for (int i = 0; i < engine->size; i++) {
     sprintf(outstring + 2 * i, "%02x", c[i]);
   }
 }
@@ -71,7 +242,7 @@ int chksumfile_compare(void *chksum1, void *chksum2) {
   uint8_t *c1 = (uint8_t *) chksum1;
   uint8_t *c2 = (uint8_t *) chksum2;
 
-  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+  for (int i = 0; i < engine->size; i++) {
     if (c1[i] != c2[i]) return 0;
   }
   return 1;
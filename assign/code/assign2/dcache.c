@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcache.h"
+
+#define DCACHE_NAME_SIZE 14   // size of direntv6.d_name
+
+struct dcacheentry {
+  int dirinumber;               // 0 if the slot is empty (inumbers start at 1)
+  char name[DCACHE_NAME_SIZE];  // not null-terminated when all 14 are used
+  int inumber;                  // -1 for a negative entry
+};
+
+struct dcache {
+  unsigned int mask;            // number of slots - 1
+  struct dcacheentry *entries;
+  struct dcache_stats stats;
+  pthread_mutex_t lock;
+};
+
+static unsigned int dcache_slot(const struct dcache *dc, int dirinumber, const char *name) {
+  // FNV-1a over the inumber and the significant part of the name
+  unsigned int h = 2166136261u ^ (unsigned int) dirinumber;
+  h *= 16777619u;
+  for (int i = 0; i < DCACHE_NAME_SIZE && name[i] != '\0'; i++) {
+    h = (h ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return h & dc->mask;
+}
+
+static int dcache_matches(const struct dcacheentry *e, int dirinumber, const char *name) {
+  return e->dirinumber == dirinumber && strncmp(e->name, name, DCACHE_NAME_SIZE) == 0;
+}
+
+struct dcache *dcache_create(int numEntries) {
+  unsigned int size = 1;
+  while (size < (unsigned int) numEntries) size <<= 1;
+
+  struct dcache *dc = malloc(sizeof(struct dcache));
+  if (dc == NULL) return NULL;
+  dc->entries = calloc(size, sizeof(struct dcacheentry));
+  if (dc->entries == NULL) {
+    free(dc);
+    return NULL;
+  }
+  dc->mask = size - 1;
+  memset(&dc->stats, 0, sizeof(dc->stats));
+  pthread_mutex_init(&dc->lock, NULL);
+  return dc;
+}
+
+void dcache_free(struct dcache *dc) {
+  if (dc == NULL) return;
+  pthread_mutex_destroy(&dc->lock);
+  free(dc->entries);
+  free(dc);
+}
+
+int dcache_lookup(struct dcache *dc, int dirinumber, const char *name, int *inumber) {
+  pthread_mutex_lock(&dc->lock);
+  const struct dcacheentry *e = &dc->entries[dcache_slot(dc, dirinumber, name)];
+  int found = dcache_matches(e, dirinumber, name);
+  if (found) {
+    *inumber = e->inumber;
+    if (e->inumber == -1) dc->stats.negativeHits++;
+    else dc->stats.hits++;
+  } else {
+    dc->stats.misses++;
+  }
+  pthread_mutex_unlock(&dc->lock);
+  return found;
+}
+
+void dcache_insert(struct dcache *dc, int dirinumber, const char *name, int inumber) {
+  pthread_mutex_lock(&dc->lock);
+  struct dcacheentry *e = &dc->entries[dcache_slot(dc, dirinumber, name)];
+  e->dirinumber = dirinumber;
+  strncpy(e->name, name, DCACHE_NAME_SIZE);
+  e->inumber = inumber;
+  pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_invalidate(struct dcache *dc, int dirinumber, const char *name) {
+  pthread_mutex_lock(&dc->lock);
+  struct dcacheentry *e = &dc->entries[dcache_slot(dc, dirinumber, name)];
+  if (dcache_matches(e, dirinumber, name)) e->dirinumber = 0;
+  pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_getstats(struct dcache *dc, struct dcache_stats *stats) {
+  pthread_mutex_lock(&dc->lock);
+  *stats = dc->stats;
+  pthread_mutex_unlock(&dc->lock);
+}
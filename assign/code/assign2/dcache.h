@@ -0,0 +1,63 @@
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+#include <stdint.h>
+
+/**
+ * The dentry cache remembers the outcome of looking a name up in a directory:
+ * (directory inumber, name) -> inumber the name refers to, or a negative entry
+ * recording that the directory has no such name.  pathname_lookup consults it
+ * before scanning a directory, so resolving many paths that share prefixes
+ * only scans each directory for each name once.
+ *
+ * The cache is a direct-mapped hash table: each (directory, name) pair has one
+ * slot it can live in, and a newer entry simply replaces whatever held the
+ * slot.  Names are compared on their first 14 characters, like
+ * directory_findname does.  All calls are safe from several threads.
+ */
+#define DCACHE_DEFAULT_ENTRIES 4096
+
+struct dcache;
+
+struct dcache_stats {
+  uint64_t hits;          // lookups answered with an inumber
+  uint64_t negativeHits;  // lookups answered with "no such name"
+  uint64_t misses;        // lookups that had to scan the directory
+};
+
+/**
+ * Creates a cache with room for numEntries entries (rounded up to a power of
+ * two).  Returns NULL on error.
+ */
+struct dcache *dcache_create(int numEntries);
+
+/**
+ * Releases the cache and everything it holds.
+ */
+void dcache_free(struct dcache *dc);
+
+/**
+ * Looks up name in directory dirinumber.  Returns 1 and sets *inumber if the
+ * cache knows the answer (*inumber is -1 for a negative entry), and 0 if the
+ * directory has to be scanned.
+ */
+int dcache_lookup(struct dcache *dc, int dirinumber, const char *name, int *inumber);
+
+/**
+ * Records that name in directory dirinumber refers to inumber, or doesn't
+ * exist if inumber is -1.
+ */
+void dcache_insert(struct dcache *dc, int dirinumber, const char *name, int inumber);
+
+/**
+ * Forgets what the cache knows about name in directory dirinumber, for when
+ * the directory changes.
+ */
+void dcache_invalidate(struct dcache *dc, int dirinumber, const char *name);
+
+/**
+ * Copies the cache's counters into stats.
+ */
+void dcache_getstats(struct dcache *dc, struct dcache_stats *stats);
+
+#endif // _DCACHE_H_
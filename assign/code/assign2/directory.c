@@ -2,6 +2,7 @@
 #include "inode.h"
 #include "diskimg.h"
 #include "file.h"
+#include "dirindex.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -9,27 +10,34 @@
 // remove the placeholder implementation and replace with your own
 int directory_findname(struct unixfilesystem *fs, const char *name,
 		       int dirinumber, struct direntv6 *dirEnt) {
-  struct inode ind;
-  if(inode_iget(fs, dirinumber, &ind) == -1) return -1;
-  if((ind.i_mode & IFMT) != IFDIR)
+  struct filestream stream;
+  if(file_openstream(fs, dirinumber, &stream) == -1) return -2;
+  if((stream.in.i_mode & IFMT) != IFDIR)
   {
     fprintf(stderr, "directory_findname: inode %d is not directory inode", dirinumber);
-    return -1;
+    return -2;
   }
+  if(fs->dirindex != NULL)
+  {
+    int i_found = dirindex_findname(fs->dirindex, fs, dirinumber, &stream.in, name, dirEnt);
+    if(i_found != -2) return i_found;
+  }
+  // one block at a time: directory blocks are worth keeping in the sector cache
   struct direntv6 buff[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
-  int file_size = inode_getsize(&ind);
-  for(int block_idx = 0; block_idx * DISKIMG_SECTOR_SIZE < file_size; block_idx++)
+  const void *block;
+  int i_nof_bytes;
+  while((i_nof_bytes = file_readstream(&stream, 1, buff, &block)) > 0)
   {
-    int i_nof_bytes = file_getblock(fs, dirinumber, block_idx, buff);
-    if(i_nof_bytes == -1) return -1;
+    const struct direntv6 *entries = block;
     for(int buff_idx = 0; buff_idx * (int)sizeof(struct direntv6) < i_nof_bytes; buff_idx++)
     {
-      if(strncmp(name, buff[buff_idx].d_name, sizeof(buff[buff_idx].d_name)) == 0)
+      if(strncmp(name, entries[buff_idx].d_name, sizeof(entries[buff_idx].d_name)) == 0)
       {
-        *dirEnt = buff[buff_idx];
+        *dirEnt = entries[buff_idx];
         return 0;
       }
     }
   }
-  return -1;
+  // only a directory read to the end can say the name isn't there
+  return i_nof_bytes < 0 ? -2 : -1;
 }
@@ -7,7 +7,8 @@
 /**
  * Looks up the specified name (name) in the specified directory (dirinumber).  
  * If found, return the directory entry in space addressed by dirEnt.  Returns 0 
- * on success and something negative on failure. 
+ * on success, -1 if the whole directory was read and the name isn't in it, and
+ * -2 if it couldn't be searched (not a directory, or an I/O error).
  */
 int directory_findname(struct unixfilesystem *fs, const char *name,
                        int dirinumber, struct direntv6 *dirEnt);
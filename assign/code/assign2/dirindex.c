@@ -0,0 +1,241 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirindex.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+#define DIRINDEX_BUCKETS 256   // directories are found through a chained table of this size
+#define NAME_SIZE ((int) sizeof(((struct direntv6 *) 0)->d_name))
+
+/**
+ * The index of one directory: its entries in directory order, and an open
+ * addressing table (linear probing, at most half full) of positions in
+ * entries, keyed on the entry name.
+ */
+struct dirhash {
+  int inumber;
+  uint16_t mtime[2];           // the directory's i_mtime and size when indexed
+  int size;
+  int numEntries;
+  struct direntv6 *entries;
+  unsigned int mask;           // table size - 1
+  int *table;                  // -1 for an empty slot
+  struct dirhash *next;        // next directory in the same bucket
+  struct dirhash *newer;       // neighbours on the list of indexes, most
+  struct dirhash *older;       // recently used first
+};
+
+/**
+ * Indexes are built without the lock held, since that means reading the
+ * whole directory.  invalidations counts the calls to dirindex_invalidate, so
+ * an index whose build overlapped one, and so may predate the change, is
+ * never installed.
+ */
+struct dirindex {
+  pthread_mutex_t lock;
+  struct dirhash *buckets[DIRINDEX_BUCKETS];
+  struct dirhash *newest;
+  struct dirhash *oldest;
+  int numEntries;              // entries held by all the indexes together
+  unsigned long invalidations;
+};
+
+static unsigned int name_hash(const char *name) {
+  unsigned int h = 2166136261u;
+  for (int i = 0; i < NAME_SIZE && name[i] != '\0'; i++) {
+    h = (h ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static void dirhash_free(struct dirhash *dh) {
+  free(dh->entries);
+  free(dh->table);
+  free(dh);
+}
+
+/**
+ * Reads the whole directory and indexes it.  Entries are only added if their
+ * name isn't in the table yet, so a lookup finds the first entry with a given
+ * name, just as a scan does.  Returns NULL on error.
+ */
+static struct dirhash *dirhash_build(struct unixfilesystem *fs, int dirinumber) {
+  struct filestream stream;
+  if (file_openstream(fs, dirinumber, &stream) < 0) return NULL;
+
+  struct dirhash *dh = calloc(1, sizeof(struct dirhash));
+  if (dh == NULL) return NULL;
+  dh->inumber = dirinumber;
+  memcpy(dh->mtime, stream.in.i_mtime, sizeof(dh->mtime));
+  dh->size = stream.size;
+  int maxEntries = stream.size / sizeof(struct direntv6);
+  unsigned int tableSize = 1;
+  while (tableSize < 2 * (unsigned int) maxEntries) tableSize <<= 1;
+  dh->mask = tableSize - 1;
+  dh->entries = malloc(maxEntries * sizeof(struct direntv6));
+  dh->table = malloc(tableSize * sizeof(int));
+  if (dh->entries == NULL || dh->table == NULL) {
+    dirhash_free(dh);
+    return NULL;
+  }
+  memset(dh->table, -1, tableSize * sizeof(int));
+
+  char buf[DISKIMG_SECTOR_SIZE];
+  const void *block;
+  int nbytes;
+  while ((nbytes = file_readstream(&stream, 1, buf, &block)) > 0) {
+    const struct direntv6 *entries = block;
+    for (int i = 0; i < nbytes / (int) sizeof(struct direntv6) && dh->numEntries < maxEntries; i++) {
+      unsigned int slot = name_hash(entries[i].d_name) & dh->mask;
+      while (dh->table[slot] != -1 &&
+             strncmp(dh->entries[dh->table[slot]].d_name, entries[i].d_name, NAME_SIZE) != 0) {
+        slot = (slot + 1) & dh->mask;
+      }
+      dh->entries[dh->numEntries] = entries[i];
+      if (dh->table[slot] == -1) dh->table[slot] = dh->numEntries;
+      dh->numEntries++;
+    }
+  }
+  if (nbytes < 0) {
+    dirhash_free(dh);
+    return NULL;
+  }
+  return dh;
+}
+
+/**
+ * Returns the first entry called name in dh, or NULL if there's none.
+ */
+static const struct direntv6 *dirhash_lookup(const struct dirhash *dh, const char *name) {
+  for (unsigned int slot = name_hash(name) & dh->mask; dh->table[slot] != -1; slot = (slot + 1) & dh->mask) {
+    const struct direntv6 *entry = &dh->entries[dh->table[slot]];
+    if (strncmp(name, entry->d_name, NAME_SIZE) == 0) return entry;
+  }
+  return NULL;
+}
+
+/**
+ * Returns the link that points to the index of dirinumber, or to NULL where
+ * it would go if there's none.  The caller holds the lock.
+ */
+static struct dirhash **dirindex_findlink(struct dirindex *di, int dirinumber) {
+  struct dirhash **link = &di->buckets[(unsigned int) dirinumber % DIRINDEX_BUCKETS];
+  while (*link != NULL && (*link)->inumber != dirinumber) link = &(*link)->next;
+  return link;
+}
+
+static void lru_unlink(struct dirindex *di, struct dirhash *dh) {
+  if (dh->newer != NULL) dh->newer->older = dh->older;
+  else di->newest = dh->older;
+  if (dh->older != NULL) dh->older->newer = dh->newer;
+  else di->oldest = dh->newer;
+}
+
+static void lru_pushnewest(struct dirindex *di, struct dirhash *dh) {
+  dh->newer = NULL;
+  dh->older = di->newest;
+  if (di->newest != NULL) di->newest->newer = dh;
+  else di->oldest = dh;
+  di->newest = dh;
+}
+
+/**
+ * Drops the index *link points to.  The caller holds the lock.
+ */
+static void dirindex_remove(struct dirindex *di, struct dirhash **link) {
+  struct dirhash *dh = *link;
+  *link = dh->next;
+  lru_unlink(di, dh);
+  di->numEntries -= dh->numEntries;
+  dirhash_free(dh);
+}
+
+struct dirindex *dirindex_create(void) {
+  struct dirindex *di = calloc(1, sizeof(struct dirindex));
+  if (di == NULL) return NULL;
+  pthread_mutex_init(&di->lock, NULL);
+  return di;
+}
+
+void dirindex_free(struct dirindex *di) {
+  if (di == NULL) return;
+  for (int b = 0; b < DIRINDEX_BUCKETS; b++) {
+    while (di->buckets[b] != NULL) {
+      struct dirhash *next = di->buckets[b]->next;
+      dirhash_free(di->buckets[b]);
+      di->buckets[b] = next;
+    }
+  }
+  pthread_mutex_destroy(&di->lock);
+  free(di);
+}
+
+int dirindex_findname(struct dirindex *di, struct unixfilesystem *fs, int dirinumber,
+                      struct inode *dirinode, const char *name, struct direntv6 *dirEnt) {
+  int size = inode_getsize(dirinode);
+  int maxEntries = size / (int) sizeof(struct direntv6);
+  if (maxEntries < DIRINDEX_MIN_ENTRIES || maxEntries > DIRINDEX_MAX_ENTRIES) return -2;
+
+  pthread_mutex_lock(&di->lock);
+  struct dirhash **link = dirindex_findlink(di, dirinumber);
+  struct dirhash *dh = *link;
+  if (dh != NULL && (dh->size != size || memcmp(dh->mtime, dirinode->i_mtime, sizeof(dh->mtime)) != 0)) {
+    // the directory changed since it was indexed
+    dirindex_remove(di, link);
+    dh = NULL;
+  }
+  if (dh == NULL) {
+    unsigned long invalidations = di->invalidations;
+    pthread_mutex_unlock(&di->lock);
+    struct dirhash *built = dirhash_build(fs, dirinumber);
+    if (built == NULL) return -2;
+
+    // other threads may have built the same index meanwhile; the first to
+    // get here installs theirs, unless the directory changed since
+    pthread_mutex_lock(&di->lock);
+    link = dirindex_findlink(di, dirinumber);
+    dh = *link;
+    if (di->invalidations != invalidations) {
+      pthread_mutex_unlock(&di->lock);
+      dirhash_free(built);
+      return -2;
+    }
+    if (dh != NULL && (dh->size != built->size || memcmp(dh->mtime, built->mtime, sizeof(dh->mtime)) != 0)) {
+      dirindex_remove(di, link);
+      dh = NULL;
+    }
+    if (dh != NULL) {
+      dirhash_free(built);
+    } else {
+      // make room by dropping the indexes used longest ago
+      while (di->oldest != NULL && di->numEntries + built->numEntries > DIRINDEX_MAX_ENTRIES) {
+        dirindex_remove(di, dirindex_findlink(di, di->oldest->inumber));
+      }
+      dh = built;
+      link = dirindex_findlink(di, dirinumber);
+      dh->next = NULL;
+      *link = dh;
+      lru_pushnewest(di, dh);
+      di->numEntries += dh->numEntries;
+    }
+  } else {
+    lru_unlink(di, dh);
+    lru_pushnewest(di, dh);
+  }
+
+  const struct direntv6 *entry = dirhash_lookup(dh, name);
+  if (entry != NULL) *dirEnt = *entry;
+  pthread_mutex_unlock(&di->lock);
+  return entry != NULL ? 0 : -1;
+}
+
+void dirindex_invalidate(struct dirindex *di, int dirinumber) {
+  pthread_mutex_lock(&di->lock);
+  di->invalidations++;
+  struct dirhash **link = dirindex_findlink(di, dirinumber);
+  if (*link != NULL) dirindex_remove(di, link);
+  pthread_mutex_unlock(&di->lock);
+}
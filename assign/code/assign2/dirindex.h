@@ -0,0 +1,56 @@
+#ifndef _DIRINDEX_H_
+#define _DIRINDEX_H_
+
+#include "direntv6.h"
+#include "ino.h"
+
+struct unixfilesystem;
+
+/**
+ * In-memory hash indexes of large directories, so directory_findname doesn't
+ * have to scan thousands of entries for every lookup.  A directory's index is
+ * built the first time a name is looked up in it and reused until the
+ * directory's inode shows a different modification time or size, at which
+ * point it's rebuilt.  Directories with fewer than DIRINDEX_MIN_ENTRIES
+ * entries aren't indexed; scanning their few blocks is just as fast.
+ *
+ * The indexes of a filesystem hold at most DIRINDEX_MAX_ENTRIES entries
+ * together; making room for a new one drops those used longest ago, and a
+ * directory too big to fit is never indexed.
+ *
+ * A struct dirindex holds the indexes of one filesystem.  All calls are safe
+ * from several threads.
+ */
+#define DIRINDEX_MIN_ENTRIES 64
+#define DIRINDEX_MAX_ENTRIES 65536
+
+struct dirindex;
+
+/**
+ * Creates an empty set of indexes.  Returns NULL on error.
+ */
+struct dirindex *dirindex_create(void);
+
+/**
+ * Releases every index in the set, and the set itself.
+ */
+void dirindex_free(struct dirindex *di);
+
+/**
+ * Looks up name in directory dirinumber, whose inode dirinode the caller has
+ * already fetched, building or rebuilding the directory's index first if
+ * needed.  Returns 0 and fills in *dirEnt if the name is there, -1 if it
+ * isn't, and -2 if the directory isn't indexed (too small, or the index
+ * couldn't be built), in which case the caller should scan it.
+ */
+int dirindex_findname(struct dirindex *di, struct unixfilesystem *fs, int dirinumber,
+                      struct inode *dirinode, const char *name, struct direntv6 *dirEnt);
+
+/**
+ * Drops the index of directory dirinumber, for when the directory changes.
+ * The modification time alone can't be trusted to catch that, since it only
+ * has a resolution of a second.
+ */
+void dirindex_invalidate(struct dirindex *di, int dirinumber);
+
+#endif // _DIRINDEX_H_
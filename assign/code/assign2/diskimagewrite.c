@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "pathname.h"
+#include "filewrite.h"
+
+/**
+ * diskimagewrite changes a disk image through the filewrite calls, so the
+ * result can be checked with diskimageaccess.  Each command is a word followed
+ * by its arguments:
+ *   mkdir <path>                       create an empty directory
+ *   create <path>                      create an empty file
+ *   write <path> <offset> <length>     write length bytes of a fixed pattern
+ *   truncate <path> <size>
+ *   unlink <path>
+ * The pattern byte at file offset o is o % 251, so the contents depend only on
+ * where they land.  Changes are written back and flushed once all commands
+ * have run.
+ */
+#define WRITE_CHUNK (64 * 1024)   // most bytes one file_write call writes
+
+static int RunCommand(struct unixfilesystem *fs, char **args, int numArgs);
+static int LookupParent(struct unixfilesystem *fs, const char *path, const char **name);
+static int WritePattern(struct unixfilesystem *fs, const char *path, int offset, int length);
+static void PrintUsageAndExit(char *progname);
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int writeThrough = 0;
+  while ((opt = getopt(argc, argv, "c:w")) != -1) {
+    switch (opt) {
+    case 'c':
+      if (diskimg_setcachesize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Can't allocate a cache of %s sectors\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'w':
+      writeThrough = 1;
+      break;
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+
+  if (optind >= argc-1) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  char *diskpath = argv[optind];
+  int fd = diskimg_open(diskpath, writeThrough ? 0 : DISKIMG_WRITEBACK);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (!fs) {
+    fprintf(stderr, "Failed to initialize unix filesystem\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int err = 0;
+  for (int i = optind + 1; i < argc && err == 0; ) {
+    int used = RunCommand(fs, &argv[i], argc - i);
+    if (used < 0) {
+      fprintf(stderr, "%s %s failed\n", argv[i], i + 1 < argc ? argv[i+1] : "");
+      err = -1;
+    }
+    i += used;
+  }
+
+  // whatever did change still goes out, in order
+  if (unixfilesystem_sync(fs) < 0) {
+    fprintf(stderr, "Error writing back %s\n", diskpath);
+    err = -1;
+  }
+  unixfilesystem_free(fs);
+  if (diskimg_close(fd) < 0) err = -1;
+  exit(err == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  return 0;
+}
+
+/**
+ * Runs the command at args[0].  Returns how many of the numArgs words it used,
+ * or -1 on error (including a missing argument or an unknown command).
+ */
+static int RunCommand(struct unixfilesystem *fs, char **args, int numArgs) {
+  const char *command = args[0];
+  if (strcmp(command, "mkdir") == 0 || strcmp(command, "create") == 0 || strcmp(command, "unlink") == 0) {
+    if (numArgs < 2) return -1;
+    const char *name;
+    int dirinumber = LookupParent(fs, args[1], &name);
+    if (dirinumber < 0) return -1;
+    int err;
+    if (strcmp(command, "mkdir") == 0) err = file_create(fs, dirinumber, name, IFDIR | 0755);
+    else if (strcmp(command, "create") == 0) err = file_create(fs, dirinumber, name, 0644);
+    else err = file_unlink(fs, dirinumber, name);
+    return err < 0 ? -1 : 2;
+  }
+  if (strcmp(command, "write") == 0) {
+    if (numArgs < 4) return -1;
+    return WritePattern(fs, args[1], atoi(args[2]), atoi(args[3])) < 0 ? -1 : 4;
+  }
+  if (strcmp(command, "truncate") == 0) {
+    if (numArgs < 3) return -1;
+    int inumber = pathname_lookup(fs, args[1]);
+    if (inumber < 0) return -1;
+    return file_truncate(fs, inumber, atoi(args[2])) < 0 ? -1 : 3;
+  }
+  fprintf(stderr, "Unknown command %s\n", command);
+  return -1;
+}
+
+/**
+ * Looks up the directory holding the absolute path's last component.  Returns
+ * its inumber and points *name at the last component, or returns -1.
+ */
+static int LookupParent(struct unixfilesystem *fs, const char *path, const char **name) {
+  const char *slash = strrchr(path, '/');
+  if (path[0] != '/' || slash[1] == '\0') return -1;
+  *name = slash + 1;
+  if (slash == path) return ROOT_INUMBER;
+
+  char *parent = strndup(path, slash - path);
+  if (parent == NULL) return -1;
+  int inumber = pathname_lookup(fs, parent);
+  free(parent);
+  return inumber;
+}
+
+static int WritePattern(struct unixfilesystem *fs, const char *path, int offset, int length) {
+  int inumber = pathname_lookup(fs, path);
+  if (inumber < 0 || offset < 0 || length < 0) return -1;
+  char *buf = malloc(WRITE_CHUNK);
+  if (buf == NULL) return -1;
+  int err = 0;
+  for (int done = 0; done < length && err == 0; ) {
+    int n = length - done < WRITE_CHUNK ? length - done : WRITE_CHUNK;
+    for (int i = 0; i < n; i++) buf[i] = (offset + done + i) % 251;
+    if (file_write(fs, inumber, offset + done, buf, n) != n) err = -1;
+    done += n;
+  }
+  free(buf);
+  return err;
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options> diskimagePath command...\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-c N   cache up to N disk sectors (default %d)\n", DISKIMG_DEFAULT_CACHE_SECTORS);
+  fprintf(stderr, "-w     write every change straight to the image instead of flushing at the end\n");
+  fprintf(stderr, "and a command is one of:\n");
+  fprintf(stderr, "mkdir PATH, create PATH, write PATH OFFSET LENGTH, truncate PATH SIZE, unlink PATH\n");
+  exit(EXIT_FAILURE);
+}
@@ -1,31 +1,529 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "diskimg.h"
 
-int diskimg_open(char *pathname, int readOnly) {
-  return open(pathname, readOnly ? O_RDONLY : O_RDWR);
+#define FLUSH_MAX_RUN 256   // most sectors a flush writes with one pwritev
+#define PREFETCH_MAX_RUN 64 // most sectors diskimg_prefetch reads at once
+#define READ_RETRIES 3      // unlocked tries diskimg_readsectors makes before taking the lock
+
+/**
+ * The sector cache is a fixed array of slots, found through a chained hash
+ * table keyed on (fd, sector number).  Slots are recycled with CLOCK: the hand
+ * sweeps the array, giving every recently used slot a second chance, and evicts
+ * the first one that hasn't been touched since the hand last passed it.
+ * A single lock guards the whole cache, so images can be read from several
+ * threads at once; the disk reads themselves happen outside of it.  Dirty
+ * sectors of DISKIMG_WRITEBACK images stay in their slots until a flush.
+ */
+struct cacheslot {
+  int fd;            // -1 if the slot holds nothing
+  int sectorNum;
+  int referenced;    // set on every hit, cleared as the clock hand passes
+  int dirty;         // written but not flushed yet
+  int order;         // DISKIMG_ORDER_* of the last write, while dirty
+  int next;          // next slot in the same hash chain, or -1
+  char data[DISKIMG_SECTOR_SIZE];
+};
+
+static struct {
+  int capacity;            // sectors the cache may hold
+  struct cacheslot *slots; // allocated on first use
+  int *buckets;            // heads of the hash chains, capacity of them
+  int hand;                // next slot the clock looks at
+  int numDirty;            // dirty slots, over all images
+  unsigned long writes;    // writes that reached the image so far, write-through or flushed (see diskimg_readsector)
+  struct diskimg_cachestats stats;
+  pthread_mutex_t lock;
+} cache = { DISKIMG_DEFAULT_CACHE_SECTORS, NULL, NULL, 0, 0, 0, { 0, 0, 0, 0 }, PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Per-image state, indexed by file descriptor: the mapping of images opened
+ * with DISKIMG_MMAP, and whether writes are deferred.  Descriptors are small
+ * integers, so a flat array grown on demand is all the lookup needed.
+ */
+struct mapping {
+  char *base;     // NULL if the descriptor isn't mapped
+  size_t size;
+  int writeback;  // opened with DISKIMG_WRITEBACK
+};
+
+static struct mapping *mappings = NULL;
+static int numMappings = 0;
+
+static const struct mapping *mapping_find(int fd) {
+  if (fd < 0 || fd >= numMappings || mappings[fd].base == NULL) return NULL;
+  return &mappings[fd];
+}
+
+static int is_writeback(int fd) {
+  return fd >= 0 && fd < numMappings && mappings[fd].writeback;
+}
+
+static struct mapping *mapping_slot(int fd) {
+  if (fd >= numMappings) {
+    struct mapping *grown = realloc(mappings, (fd + 1) * sizeof(struct mapping));
+    if (grown == NULL) return NULL;
+    for (int i = numMappings; i <= fd; i++) {
+      grown[i].base = NULL;
+      grown[i].writeback = 0;
+    }
+    mappings = grown;
+    numMappings = fd + 1;
+  }
+  return &mappings[fd];
+}
+
+static int mapping_add(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) return -1;
+  struct mapping *m = mapping_slot(fd);
+  if (m == NULL) return -1;
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) return -1;
+  m->base = base;
+  m->size = st.st_size;
+  return 0;
+}
+
+static int cache_bucket(int fd, int sectorNum) {
+  unsigned int h = (unsigned int) sectorNum * 2654435761u ^ (unsigned int) fd;
+  return h % cache.capacity;
+}
+
+static int cache_allocate(void) {
+  cache.slots = malloc(cache.capacity * sizeof(struct cacheslot));
+  cache.buckets = malloc(cache.capacity * sizeof(int));
+  if (cache.slots == NULL || cache.buckets == NULL) {
+    free(cache.slots);
+    free(cache.buckets);
+    cache.slots = NULL;
+    cache.buckets = NULL;
+    cache.capacity = 0;
+    return -1;
+  }
+  for (int i = 0; i < cache.capacity; i++) {
+    cache.slots[i].fd = -1;
+    cache.slots[i].dirty = 0;
+    cache.buckets[i] = -1;
+  }
+  cache.hand = 0;
+  return 0;
+}
+
+static struct cacheslot *cache_find(int fd, int sectorNum) {
+  for (int i = cache.buckets[cache_bucket(fd, sectorNum)]; i != -1; i = cache.slots[i].next) {
+    if (cache.slots[i].fd == fd && cache.slots[i].sectorNum == sectorNum) return &cache.slots[i];
+  }
+  return NULL;
+}
+
+static void cache_unlink(int slot) {
+  struct cacheslot *s = &cache.slots[slot];
+  int *link = &cache.buckets[cache_bucket(s->fd, s->sectorNum)];
+  while (*link != slot) link = &cache.slots[*link].next;
+  *link = s->next;
+  s->fd = -1;
+  if (s->dirty) cache.numDirty--;
+  s->dirty = 0;
+}
+
+/**
+ * Picks a slot for a new sector, evicting whatever it held, and hashes it in
+ * under (fd, sectorNum).  The caller fills in the data.  Dirty slots are
+ * passed over; returns NULL if every slot is dirty.
+ */
+static struct cacheslot *cache_insert(int fd, int sectorNum) {
+  for (int steps = 0; cache.slots[cache.hand].fd != -1; steps++) {
+    struct cacheslot *s = &cache.slots[cache.hand];
+    if (steps == 2 * cache.capacity) return NULL;
+    if (!s->dirty && !s->referenced) break;
+    s->referenced = 0;
+    cache.hand = (cache.hand + 1) % cache.capacity;
+  }
+  int slot = cache.hand;
+  cache.hand = (cache.hand + 1) % cache.capacity;
+  if (cache.slots[slot].fd != -1) {
+    cache_unlink(slot);
+    cache.stats.evictions++;
+  }
+
+  struct cacheslot *s = &cache.slots[slot];
+  int bucket = cache_bucket(fd, sectorNum);
+  s->fd = fd;
+  s->sectorNum = sectorNum;
+  s->referenced = 0;
+  s->dirty = 0;
+  s->next = cache.buckets[bucket];
+  cache.buckets[bucket] = slot;
+  return s;
+}
+
+/**
+ * Sorts dirty slots into the order a flush writes them in.
+ */
+static int dirty_compare(const void *a, const void *b) {
+  const struct cacheslot *s1 = &cache.slots[*(const int *) a];
+  const struct cacheslot *s2 = &cache.slots[*(const int *) b];
+  if (s1->order != s2->order) return s1->order - s2->order;
+  return (s1->sectorNum > s2->sectorNum) - (s1->sectorNum < s2->sectorNum);
+}
+
+/**
+ * Writes out fd's dirty slots, one order at a time with an fdatasync after
+ * each, and every run of consecutive sectors with one pwritev.  Called with
+ * the lock held.
+ */
+static int cache_flush(int fd) {
+  if (cache.numDirty == 0) return 0;
+  int *dirty = malloc(cache.numDirty * sizeof(int));
+  if (dirty == NULL) return -1;
+  int numDirty = 0;
+  for (int i = 0; i < cache.capacity; i++) {
+    if (cache.slots[i].fd == fd && cache.slots[i].dirty) dirty[numDirty++] = i;
+  }
+  qsort(dirty, numDirty, sizeof(int), dirty_compare);
+
+  int err = 0;
+  for (int first = 0; first < numDirty && err == 0; ) {
+    struct cacheslot *s = &cache.slots[dirty[first]];
+    int run = 1;
+    struct iovec iov[FLUSH_MAX_RUN];
+    iov[0].iov_base = s->data;
+    iov[0].iov_len = DISKIMG_SECTOR_SIZE;
+    while (first + run < numDirty && run < FLUSH_MAX_RUN) {
+      struct cacheslot *next = &cache.slots[dirty[first + run]];
+      if (next->order != s->order || next->sectorNum != s->sectorNum + run) break;
+      iov[run].iov_base = next->data;
+      iov[run].iov_len = DISKIMG_SECTOR_SIZE;
+      run++;
+    }
+    if (pwritev(fd, iov, run, (off_t) s->sectorNum * DISKIMG_SECTOR_SIZE) != run * DISKIMG_SECTOR_SIZE) {
+      err = -1;
+      break;
+    }
+    for (int i = first; i < first + run; i++) cache.slots[dirty[i]].dirty = 0;
+    cache.numDirty -= run;
+    cache.writes++;
+    first += run;
+    // the next order may only reach the disk once this one has
+    if ((first == numDirty || cache.slots[dirty[first]].order != s->order) && fdatasync(fd) < 0) err = -1;
+  }
+  free(dirty);
+  return err;
+}
+
+/**
+ * Flushes every image with dirty sectors.  Called with the lock held.
+ */
+static int cache_flush_all(void) {
+  int err = 0;
+  for (int i = 0; i < cache.capacity && cache.numDirty > 0; i++) {
+    if (cache.slots[i].dirty && cache_flush(cache.slots[i].fd) < 0) err = -1;
+    if (err < 0) break;
+  }
+  return err;
+}
+
+int diskimg_open(char *pathname, int flags) {
+  // deferred writes would be invisible through a mapping
+  if ((flags & DISKIMG_WRITEBACK) && (flags & (DISKIMG_MMAP | DISKIMG_READONLY))) return -1;
+  int fd = open(pathname, (flags & DISKIMG_READONLY) ? O_RDONLY : O_RDWR);
+  if (fd < 0) return fd;
+  if (flags & DISKIMG_WRITEBACK) {
+    struct mapping *m = mapping_slot(fd);
+    if (m == NULL) {
+      close(fd);
+      return -1;
+    }
+    m->writeback = 1;
+  }
+  if (!(flags & DISKIMG_MMAP)) return fd;
+  if (mapping_add(fd) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
 int diskimg_getsize(int fd) {
-  return lseek(fd, 0, SEEK_END);
+  struct stat st;
+  if (fstat(fd, &st) < 0) return -1;
+  return st.st_size;
+}
+
+/**
+ * All image I/O goes through pread/pwrite: one syscall per access instead of
+ * an lseek plus a read, and no shared file offset, so the descriptor can be
+ * used from several threads at once.
+ */
+static int diskimg_readsectors_uncached(int fd, int sectorNum, int numSectors, void *buf) {
+  if (sectorNum < 0) return -1;
+  return pread(fd, buf, (size_t) numSectors * DISKIMG_SECTOR_SIZE, (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+}
+
+/**
+ * Returns where the run of numSectors sectors at sectorNum lives in fd's
+ * mapping, or NULL if fd isn't mapped.  *nbytes is set to how much of the run
+ * the image holds (0 past its end, -1 for a negative sector number).
+ */
+static const char *mapped_sectors(int fd, int sectorNum, int numSectors, int *nbytes) {
+  const struct mapping *m = mapping_find(fd);
+  if (m == NULL) return NULL;
+  off_t offset = (off_t) sectorNum * DISKIMG_SECTOR_SIZE;
+  size_t length = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+  if (offset < 0) *nbytes = -1;
+  else if ((size_t) offset >= m->size) *nbytes = 0;
+  else if (m->size - offset < length) *nbytes = m->size - offset;
+  else *nbytes = length;
+  return m->base + offset;
 }
 
 int diskimg_readsector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) return -1;  
-  return read(fd, buf, DISKIMG_SECTOR_SIZE);
+  int nbytes;
+  const char *sector = mapped_sectors(fd, sectorNum, 1, &nbytes);
+  if (sector != NULL) {
+    if (nbytes > 0) memcpy(buf, sector, nbytes);
+    return nbytes;
+  }
+
+  pthread_mutex_lock(&cache.lock);
+  if (cache.capacity == 0 || (cache.slots == NULL && cache_allocate() < 0)) {
+    pthread_mutex_unlock(&cache.lock);
+    return diskimg_readsectors_uncached(fd, sectorNum, 1, buf);
+  }
+
+  struct cacheslot *s = cache_find(fd, sectorNum);
+  if (s != NULL) {
+    cache.stats.hits++;
+    s->referenced = 1;
+    memcpy(buf, s->data, DISKIMG_SECTOR_SIZE);
+    pthread_mutex_unlock(&cache.lock);
+    return DISKIMG_SECTOR_SIZE;
+  }
+  cache.stats.misses++;
+  unsigned long writes = cache.writes;
+  pthread_mutex_unlock(&cache.lock);
+
+  nbytes = diskimg_readsectors_uncached(fd, sectorNum, 1, buf);
+  // only whole sectors are worth remembering; errors and short reads at the
+  // end of the image are passed straight back.  Another thread may have
+  // cached the same sector while this one was reading it, or written it
+  // through without a cached copy to update, in which case what was read may
+  // already be stale.
+  if (nbytes == DISKIMG_SECTOR_SIZE) {
+    pthread_mutex_lock(&cache.lock);
+    struct cacheslot *s = NULL;
+    if (cache.slots != NULL && cache.writes == writes && cache_find(fd, sectorNum) == NULL) {
+      s = cache_insert(fd, sectorNum);
+    }
+    if (s != NULL) memcpy(s->data, buf, DISKIMG_SECTOR_SIZE);
+    pthread_mutex_unlock(&cache.lock);
+  }
+  return nbytes;
+}
+
+const void *diskimg_getsector_ptr(int fd, int sectorNum, void *buf) {
+  int nbytes;
+  const char *sector = mapped_sectors(fd, sectorNum, 1, &nbytes);
+  if (sector != NULL) return nbytes == DISKIMG_SECTOR_SIZE ? sector : NULL;
+  return diskimg_readsector(fd, sectorNum, buf) == DISKIMG_SECTOR_SIZE ? buf : NULL;
+}
+
+int diskimg_readsectors(int fd, int sectorNum, int numSectors, void *buf) {
+  if (numSectors == 1) return diskimg_readsector(fd, sectorNum, buf);
+  int nbytes;
+  const char *sectors = mapped_sectors(fd, sectorNum, numSectors, &nbytes);
+  if (sectors != NULL) {
+    if (nbytes > 0) memcpy(buf, sectors, nbytes);
+    return nbytes;
+  }
+
+  // the image is stale wherever the cache holds sectors not written back yet,
+  // so those are copied over what was read.  That only works if nothing
+  // reached the image during the read: a flush in between would have left
+  // the new data on disk and its slots clean, with the old data read.  So the
+  // read is retried while writes keep landing, and in the end made with the
+  // lock held, which keeps flushes out.
+  pthread_mutex_lock(&cache.lock);
+  for (int attempt = 0; ; attempt++) {
+    unsigned long writes = cache.writes;
+    int locked = attempt == READ_RETRIES;
+    if (!locked) pthread_mutex_unlock(&cache.lock);
+    nbytes = diskimg_readsectors_uncached(fd, sectorNum, numSectors, buf);
+    if (!locked) pthread_mutex_lock(&cache.lock);
+    if (locked || cache.writes == writes) break;
+  }
+  for (int i = 0; cache.numDirty > 0 && i < nbytes / DISKIMG_SECTOR_SIZE; i++) {
+    struct cacheslot *s = cache_find(fd, sectorNum + i);
+    if (s != NULL && s->dirty) memcpy((char *) buf + i * DISKIMG_SECTOR_SIZE, s->data, DISKIMG_SECTOR_SIZE);
+  }
+  pthread_mutex_unlock(&cache.lock);
+  return nbytes;
+}
+
+const void *diskimg_getsectors_ptr(int fd, int sectorNum, int numSectors, void *buf) {
+  if (numSectors == 1) return diskimg_getsector_ptr(fd, sectorNum, buf);
+  int nbytes;
+  const char *sectors = mapped_sectors(fd, sectorNum, numSectors, &nbytes);
+  if (sectors != NULL) return nbytes == numSectors * DISKIMG_SECTOR_SIZE ? sectors : NULL;
+  return diskimg_readsectors(fd, sectorNum, numSectors, buf) == numSectors * DISKIMG_SECTOR_SIZE ? buf : NULL;
+}
+
+int diskimg_prefetch(int fd, int sectorNum, int numSectors) {
+  if (sectorNum < 0 || numSectors <= 0) return 0;
+  const struct mapping *m = mapping_find(fd);
+  if (m != NULL) {
+    off_t offset = (off_t) sectorNum * DISKIMG_SECTOR_SIZE;
+    if ((size_t) offset >= m->size) return numSectors;
+    size_t length = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+    if (m->size - offset < length) length = m->size - offset;
+    // madvise wants a page-aligned start
+    off_t start = offset & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+    madvise(m->base + start, length + (offset - start), MADV_WILLNEED);
+    return numSectors;
+  }
+
+  pthread_mutex_lock(&cache.lock);
+  if (cache.capacity == 0 || (cache.slots == NULL && cache_allocate() < 0)) {
+    pthread_mutex_unlock(&cache.lock);
+    posix_fadvise(fd, (off_t) sectorNum * DISKIMG_SECTOR_SIZE, (off_t) numSectors * DISKIMG_SECTOR_SIZE,
+                  POSIX_FADV_WILLNEED);
+    return numSectors;
+  }
+  // keep read-ahead from flushing out more than a quarter of the cache
+  int limit = cache.capacity / 4 < PREFETCH_MAX_RUN ? cache.capacity / 4 : PREFETCH_MAX_RUN;
+  if (numSectors > limit) numSectors = limit;
+  // only read the stretch between the first and the last sector not cached yet
+  int first = sectorNum, count = numSectors;
+  while (count > 0 && cache_find(fd, first) != NULL) {
+    first++;
+    count--;
+  }
+  while (count > 0 && cache_find(fd, first + count - 1) != NULL) count--;
+  unsigned long writes = cache.writes;
+  pthread_mutex_unlock(&cache.lock);
+  if (count == 0) return numSectors;
+
+  char buf[PREFETCH_MAX_RUN * DISKIMG_SECTOR_SIZE];
+  int nbytes = diskimg_readsectors_uncached(fd, first, count, buf);
+  if (nbytes <= 0) return first - sectorNum;
+
+  // as in diskimg_readsector, sectors cached in the meantime (possibly dirty)
+  // are left alone, and nothing is cached if a write went through meanwhile
+  pthread_mutex_lock(&cache.lock);
+  for (int i = 0; cache.slots != NULL && cache.writes == writes && i < nbytes / DISKIMG_SECTOR_SIZE; i++) {
+    if (cache_find(fd, first + i) != NULL) continue;
+    struct cacheslot *s = cache_insert(fd, first + i);
+    if (s == NULL) break;
+    memcpy(s->data, buf + i * DISKIMG_SECTOR_SIZE, DISKIMG_SECTOR_SIZE);
+    // a second chance, or the next prefetch would evict these before they're read
+    s->referenced = 1;
+    cache.stats.prefetched++;
+  }
+  pthread_mutex_unlock(&cache.lock);
+  return nbytes == count * DISKIMG_SECTOR_SIZE ? numSectors : first - sectorNum + nbytes / DISKIMG_SECTOR_SIZE;
 }
 
 int diskimg_writesector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) {
-    return -1;
+  return diskimg_writesector_ordered(fd, sectorNum, buf, DISKIMG_ORDER_DATA);
+}
+
+int diskimg_writesector_ordered(int fd, int sectorNum, void *buf, int order) {
+  if (sectorNum < 0) return -1;
+  if (is_writeback(fd)) {
+    pthread_mutex_lock(&cache.lock);
+    if (cache.capacity > 0 && (cache.slots != NULL || cache_allocate() == 0)) {
+      struct cacheslot *s = cache_find(fd, sectorNum);
+      if (s == NULL) s = cache_insert(fd, sectorNum);
+      if (s == NULL) {
+        // nothing but dirty sectors left: write them all out to make room
+        if (cache_flush_all() < 0) {
+          pthread_mutex_unlock(&cache.lock);
+          return -1;
+        }
+        s = cache_insert(fd, sectorNum);
+      }
+      memcpy(s->data, buf, DISKIMG_SECTOR_SIZE);
+      s->referenced = 1;
+      if (!s->dirty) cache.numDirty++;
+      s->dirty = 1;
+      s->order = order;
+      pthread_mutex_unlock(&cache.lock);
+      return DISKIMG_SECTOR_SIZE;
+    }
+    pthread_mutex_unlock(&cache.lock);
+  }
+
+  int nbytes = pwrite(fd, buf, DISKIMG_SECTOR_SIZE, (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+  pthread_mutex_lock(&cache.lock);
+  // a read that missed before this write reached the image mustn't cache what
+  // it got, since there may be no slot here for this write to update
+  cache.writes++;
+  if (cache.slots != NULL) {
+    struct cacheslot *s = cache_find(fd, sectorNum);
+    if (s != NULL && nbytes == DISKIMG_SECTOR_SIZE) memcpy(s->data, buf, DISKIMG_SECTOR_SIZE);
+    else if (s != NULL) cache_unlink(s - cache.slots);
   }
+  pthread_mutex_unlock(&cache.lock);
+  return nbytes;
+}
 
-  return write(fd, buf, DISKIMG_SECTOR_SIZE);
+int diskimg_flush(int fd) {
+  pthread_mutex_lock(&cache.lock);
+  int err = cache.slots != NULL ? cache_flush(fd) : 0;
+  pthread_mutex_unlock(&cache.lock);
+  return err;
 }
 
 int diskimg_close(int fd) {
-  return close(fd);
+  const struct mapping *m = mapping_find(fd);
+  if (m != NULL) {
+    munmap(m->base, m->size);
+    mappings[fd].base = NULL;
+  }
+  if (fd >= 0 && fd < numMappings) mappings[fd].writeback = 0;
+
+  // the descriptor number may be reused by the next open, so forget its
+  // sectors, writing out the dirty ones first
+  pthread_mutex_lock(&cache.lock);
+  int err = 0;
+  if (cache.slots != NULL) {
+    err = cache_flush(fd);
+    for (int i = 0; i < cache.capacity; i++) {
+      if (cache.slots[i].fd == fd) cache_unlink(i);
+    }
+  }
+  pthread_mutex_unlock(&cache.lock);
+  if (close(fd) < 0) err = -1;
+  return err;
+}
+
+int diskimg_setcachesize(int numSectors) {
+  pthread_mutex_lock(&cache.lock);
+  if (cache.slots != NULL && cache_flush_all() < 0) {
+    pthread_mutex_unlock(&cache.lock);
+    return -1;
+  }
+  free(cache.slots);
+  free(cache.buckets);
+  cache.slots = NULL;
+  cache.buckets = NULL;
+  cache.capacity = numSectors > 0 ? numSectors : 0;
+  int err = cache.capacity == 0 ? 0 : cache_allocate();
+  pthread_mutex_unlock(&cache.lock);
+  return err;
+}
+
+void diskimg_getcachestats(struct diskimg_cachestats *stats) {
+  pthread_mutex_lock(&cache.lock);
+  *stats = cache.stats;
+  pthread_mutex_unlock(&cache.lock);
 }
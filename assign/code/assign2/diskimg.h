@@ -6,11 +6,24 @@
 // Size of a disk sector (e.g. block) in bytes.
 #define DISKIMG_SECTOR_SIZE 512
 
+/**
+ * Flags for diskimg_open.  DISKIMG_MMAP maps the whole image into memory at open
+ * time: sector reads then become memory copies (no syscalls, no sector cache),
+ * and diskimg_getsector_ptr can hand out pointers straight into the mapping.
+ * DISKIMG_WRITEBACK makes writes to a read-write image land in the sector
+ * cache, to be written out by diskimg_flush (see below).
+ */
+#define DISKIMG_READONLY  1
+#define DISKIMG_MMAP      2
+#define DISKIMG_WRITEBACK 4
+
 /**
  * Opens a disk image for I/O. Returns an open file descriptor, or -1 if
- * unsuccessful.  
+ * unsuccessful.  flags is DISKIMG_READONLY (or 0 for read-write), optionally
+ * or'ed with DISKIMG_MMAP, or DISKIMG_WRITEBACK for a read-write image that
+ * isn't mapped.
  */
-int diskimg_open(char *pathname, int readOnly);
+int diskimg_open(char *pathname, int flags);
 
 /**
  * Returns the size of the disk imgage in bytes, or -1 if unsuccessful.
@@ -23,16 +36,114 @@ int diskimg_getsize(int fd);
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Zero-copy variant of diskimg_readsector.  If the image was opened with
+ * DISKIMG_MMAP, returns a pointer to the sector inside the mapping and buf is
+ * left untouched; otherwise the sector is read into buf and buf is returned.
+ * Either way the sector's bytes are at the returned address (valid until the
+ * image is closed), or NULL is returned on error.  The memory must not be
+ * written to.
+ */
+const void *diskimg_getsector_ptr(int fd, int sectorNum, void *buf);
+
+/**
+ * Reads numSectors contiguous sectors starting at sectorNum into buf with a
+ * single syscall.  Returns the number of bytes read (less than numSectors
+ * whole sectors only at the end of the image), or -1 on error.  Runs longer
+ * than one sector are read straight from the image, not through the sector
+ * cache: they're meant for file data, which would only push the hot metadata
+ * sectors out of it.
+ */
+int diskimg_readsectors(int fd, int sectorNum, int numSectors, void *buf);
+
+/**
+ * Zero-copy variant of diskimg_readsectors, with the same contract as
+ * diskimg_getsector_ptr: returns where the whole run can be read (inside the
+ * mapping, or buf after reading into it), or NULL unless all numSectors
+ * sectors were available.
+ */
+const void *diskimg_getsectors_ptr(int fd, int sectorNum, int numSectors, void *buf);
+
+/**
+ * Hints that the numSectors sectors starting at sectorNum will be read soon.
+ * With the sector cache on, the ones it doesn't hold yet are read with a
+ * single syscall and cached, so the reads that follow are hits; otherwise the
+ * kernel is asked to start reading them in the background (madvise on a
+ * mapped image, posix_fadvise on others).  A cache read stops short of
+ * numSectors when that many would push a good part of the cache out.
+ * Returns how many sectors from sectorNum on were taken care of.
+ */
+int diskimg_prefetch(int fd, int sectorNum, int numSectors);
+
 /**
  * Writes the specified sector from the disk.  Returns the number of bytes
- * written, or -1 on error.
+ * written, or -1 on error.  Same as diskimg_writesector_ordered with
+ * DISKIMG_ORDER_DATA.
  */
 int diskimg_writesector(int fd, int sectorNum, void *buf); 
 
 /**
- * Clean up from a previous diskimg_open() call.  Returns 0 on success, or -1 on
- * error.
+ * On an image opened with DISKIMG_WRITEBACK, writes only dirty the sector's
+ * copy in the cache, and repeated writes to the same sector cost nothing
+ * until diskimg_flush writes it out once.  Each dirty sector carries the
+ * order it was last written with, and a flush writes all of one order (sorted
+ * by sector, contiguous sectors in a single syscall) and waits for the disk
+ * before starting on the next, so that on-disk structures are never made to
+ * point at sectors that haven't been written yet.  Should the cache fill up
+ * with dirty sectors, it is flushed as a whole.
+ *
+ * On other images, and when the cache is off, writes go straight through.
+ */
+#define DISKIMG_ORDER_DATA       0   // file contents
+#define DISKIMG_ORDER_INDIRECT   1   // indirect blocks, free list blocks
+#define DISKIMG_ORDER_INODE      2   // inode sectors
+#define DISKIMG_ORDER_DIRECTORY  3   // directory contents
+#define DISKIMG_ORDER_SUPERBLOCK 4
+#define DISKIMG_NUM_ORDERS       5
+
+int diskimg_writesector_ordered(int fd, int sectorNum, void *buf, int order);
+
+/**
+ * Writes out every dirty sector of fd, in order (see above).  Returns 0 on
+ * success, or -1 on error, in which case the sectors not written stay dirty.
+ */
+int diskimg_flush(int fd);
+
+/**
+ * Clean up from a previous diskimg_open() call, flushing any dirty sectors
+ * first.  Returns 0 on success, or -1 on error.
  */
 int diskimg_close(int fd);
 
+/**
+ * diskimg_readsector is backed by a fixed-size sector cache shared by all open
+ * images, so hot sectors (inode blocks, indirect blocks, directories) are only
+ * read from the image once.  Eviction uses the CLOCK algorithm, and never
+ * picks a dirty sector.  Writes to images not opened with DISKIMG_WRITEBACK go
+ * straight through to the image and update any cached copy.
+ *
+ * Sectors may be read and written from several threads at once.  Opening and
+ * closing images must not race with I/O on other images, though.
+ */
+#define DISKIMG_DEFAULT_CACHE_SECTORS 1024
+
+struct diskimg_cachestats {
+  uint64_t hits;        // reads answered from the cache
+  uint64_t misses;      // reads that went to the image
+  uint64_t evictions;   // cached sectors dropped to make room for others
+  uint64_t prefetched;  // sectors diskimg_prefetch read into the cache
+};
+
+/**
+ * Sets the number of sectors the cache can hold, flushing all dirty sectors
+ * and dropping everything cached so far.  0 turns the cache off.  Returns 0 on success, or -1 if the cache
+ * couldn't be allocated (in which case it is left off).
+ */
+int diskimg_setcachesize(int numSectors);
+
+/**
+ * Copies the cache counters accumulated since the program started into stats.
+ */
+void diskimg_getcachestats(struct diskimg_cachestats *stats);
+
 #endif // _DISKIMG_H_
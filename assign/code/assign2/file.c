@@ -1,12 +1,53 @@
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include "file.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "readahead.h"
 
 // remove the placeholder implementation and replace with your own
 int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
+  const void *data;
+  int i_nof_bytes = file_getblock_ptr(fs, inumber, blockNum, buf, &data);
+  if(i_nof_bytes > 0 && data != buf) memcpy(buf, data, i_nof_bytes);
+  return i_nof_bytes;
+}
+
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int blockNum, void *buf, const void **data) {
+  return file_getblocks_ptr(fs, inumber, blockNum, 1, buf, data);
+}
+
+/**
+ * Fetches the blocks the read-ahead tracker asks for, one diskimg_prefetch
+ * per run of blocks that sit next to each other on disk.
+ */
+static void file_readahead(struct unixfilesystem *fs, int inumber, struct inode *inp, int blockNum,
+                           int numFileBlocks)
+{
+  int i_first_block;
+  int i_nof_blocks = readahead_advance(fs->readahead, inumber, blockNum, numFileBlocks, &i_first_block);
+  int i_done = 0;
+  while(i_done < i_nof_blocks)
+  {
+    int i_run_start = inode_indexlookup(fs, inp, i_first_block + i_done);
+    if(i_run_start <= 0) break;
+    int i_run_length = 1;
+    while(i_done + i_run_length < i_nof_blocks &&
+          inode_indexlookup(fs, inp, i_first_block + i_done + i_run_length) == i_run_start + i_run_length)
+    {
+      i_run_length++;
+    }
+    int i_fetched = diskimg_prefetch(fs->dfd, i_run_start, i_run_length);
+    i_done += i_fetched;
+    if(i_fetched < i_run_length) break;
+  }
+  if(i_done < i_nof_blocks) readahead_shortfall(fs->readahead, inumber, i_first_block + i_done);
+}
+
+int file_getblocks_ptr(struct unixfilesystem *fs, int inumber, int blockNum, int maxBlocks,
+                       void *buf, const void **data) {
   struct inode in;
   if(inode_iget(fs, inumber, &in) == -1) return -1;
   int i_file_size = inode_getsize(&in);
@@ -16,19 +57,111 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
     fprintf(stderr, "file_getblock, blockNum exceeds file size\n");
     return -1;  
   }
+  // single blocks are what sequential readers ask for; longer runs are
+  // already read with one syscall
+  if(maxBlocks == 1 && fs->readahead != NULL) file_readahead(fs, inumber, &in, blockNum, i_nof_necessary_blocks);
+
   int i_sector_number = inode_indexlookup(fs, &in, blockNum);
   if(i_sector_number == -1)return -1;
-  int i_read_nof_bytes = diskimg_readsector(fs->dfd, i_sector_number, buf);
-  if(i_read_nof_bytes == -1) 
+
+  // grow the run for as long as the next block is the next sector on disk
+  int i_nof_blocks = 1;
+  while(i_nof_blocks < maxBlocks && blockNum + i_nof_blocks < i_nof_necessary_blocks &&
+        inode_indexlookup(fs, &in, blockNum + i_nof_blocks) == i_sector_number + i_nof_blocks)
   {
-    fprintf(stderr, "file_getblock, Error reading sector %d, returning -1\n", i_sector_number);
+    i_nof_blocks++;
+  }
+
+  *data = diskimg_getsectors_ptr(fs->dfd, i_sector_number, i_nof_blocks, buf);
+  if(*data == NULL) 
+  {
+    fprintf(stderr, "file_getblock, Error reading sectors %d..%d, returning -1\n", i_sector_number,
+            i_sector_number + i_nof_blocks - 1);
     return -1;  
   }
 
-  if(blockNum < i_nof_necessary_blocks - 1)
+  if(blockNum + i_nof_blocks < i_nof_necessary_blocks)
   {
-    return DISKIMG_SECTOR_SIZE;
+    return i_nof_blocks * DISKIMG_SECTOR_SIZE;
   }
   
-  return i_file_size - (i_nof_necessary_blocks - 1) * DISKIMG_SECTOR_SIZE;
+  return i_file_size - blockNum * DISKIMG_SECTOR_SIZE;
+}
+
+int file_openstream(struct unixfilesystem *fs, int inumber, struct filestream *stream) {
+  stream->fs = fs;
+  if(inode_iget(fs, inumber, &stream->in) == -1) return -1;
+  stream->size = inode_getsize(&stream->in);
+  stream->numBlocks = (stream->size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  stream->nextBlock = 0;
+  stream->indirectIndex = -1;
+  stream->doublyLoaded = 0;
+  return 0;
+}
+
+/**
+ * Same mapping as inode_indexlookup, except that the indirect blocks it goes
+ * through are kept in the stream, so walking the file in order loads each of
+ * them once.
+ */
+static int stream_blocksector(struct filestream *stream, int blockNum) {
+  const int i_nof_block_numbers = DISKIMG_SECTOR_SIZE / sizeof(uint16_t); // 256 per indirect block
+  if((stream->in.i_mode & ILARG) == 0) return stream->in.i_addr[blockNum];
+
+  int i_indirect_block_idx = blockNum / i_nof_block_numbers;
+  if(i_indirect_block_idx != stream->indirectIndex)
+  {
+    int i_indirect_block_disc_number;
+    if(i_indirect_block_idx < 7)
+    {
+      i_indirect_block_disc_number = stream->in.i_addr[i_indirect_block_idx];
+    }
+    else
+    {
+      if(!stream->doublyLoaded)
+      {
+        if(diskimg_readsector(stream->fs->dfd, stream->in.i_addr[7], stream->doubly) != DISKIMG_SECTOR_SIZE)
+        {
+          fprintf(stderr, "file_readstream: Error reading sector %d, returning -1\n", stream->in.i_addr[7]);
+          return -1;
+        }
+        stream->doublyLoaded = 1;
+      }
+      i_indirect_block_disc_number = stream->doubly[i_indirect_block_idx - 7];
+    }
+    if(diskimg_readsector(stream->fs->dfd, i_indirect_block_disc_number, stream->indirect) != DISKIMG_SECTOR_SIZE)
+    {
+      fprintf(stderr, "file_readstream: Error reading sector %d, returning -1\n", i_indirect_block_disc_number);
+      return -1;
+    }
+    stream->indirectIndex = i_indirect_block_idx;
+  }
+  return stream->indirect[blockNum % i_nof_block_numbers];
+}
+
+int file_readstream(struct filestream *stream, int maxBlocks, void *buf, const void **data) {
+  if(stream->nextBlock >= stream->numBlocks) return 0;
+  int blockNum = stream->nextBlock;
+  int i_sector_number = stream_blocksector(stream, blockNum);
+  if(i_sector_number == -1) return -1;
+
+  int i_nof_blocks = 1;
+  while(i_nof_blocks < maxBlocks && blockNum + i_nof_blocks < stream->numBlocks)
+  {
+    int i_next_sector = stream_blocksector(stream, blockNum + i_nof_blocks);
+    if(i_next_sector == -1) return -1;
+    if(i_next_sector != i_sector_number + i_nof_blocks) break;
+    i_nof_blocks++;
+  }
+
+  *data = diskimg_getsectors_ptr(stream->fs->dfd, i_sector_number, i_nof_blocks, buf);
+  if(*data == NULL)
+  {
+    fprintf(stderr, "file_readstream: Error reading sectors %d..%d, returning -1\n", i_sector_number,
+            i_sector_number + i_nof_blocks - 1);
+    return -1;
+  }
+  stream->nextBlock += i_nof_blocks;
+  if(stream->nextBlock < stream->numBlocks) return i_nof_blocks * DISKIMG_SECTOR_SIZE;
+  return stream->size - blockNum * DISKIMG_SECTOR_SIZE;
 }
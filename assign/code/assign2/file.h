@@ -2,11 +2,65 @@
 #define _FILE_H_
 
 #include "unixfilesystem.h"
+#include "diskimg.h"
 
 /**
  * Fetches the specified file block from the specified inode.
  * Returns the number of valid bytes in the block, -1 on error.
+ * Fetching a file's blocks in order makes the ones after them get read ahead
+ * into the sector cache (see readahead.h).
  */
 int file_getblock(struct unixfilesystem *fs, int inumber, int blockNo, void *buf); 
 
+/**
+ * Zero-copy variant of file_getblock: *data is pointed at the block's bytes,
+ * which live inside the disk image's mapping if it was opened with DISKIMG_MMAP
+ * and in buf otherwise (see diskimg_getsector_ptr).
+ * Returns the number of valid bytes in the block, -1 on error.
+ */
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int blockNo, void *buf, const void **data);
+
+/**
+ * Like file_getblock_ptr, but fetches up to maxBlocks blocks starting at
+ * blockNo in one read, for as long as they sit next to each other on disk.
+ * buf must have room for maxBlocks blocks.  Returns the number of valid bytes
+ * fetched (a whole number of blocks, except at the end of the file), -1 on
+ * error.
+ */
+int file_getblocks_ptr(struct unixfilesystem *fs, int inumber, int blockNo, int maxBlocks,
+                       void *buf, const void **data);
+
+/**
+ * A filestream reads a whole file front to back.  The inode is fetched once,
+ * when the stream is opened, and the block map is walked in order, so every
+ * singly- and doubly-indirect block is read exactly once rather than once per
+ * data block as file_getblock does.
+ */
+struct filestream {
+  struct unixfilesystem *fs;
+  struct inode in;
+  int size;            // file size in bytes
+  int numBlocks;       // data blocks in the file
+  int nextBlock;       // next block file_readstream hands out
+  int indirectIndex;   // which singly-indirect block is in indirect[], -1 for none yet
+  int doublyLoaded;    // whether doubly[] holds the doubly-indirect block
+  uint16_t indirect[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+  uint16_t doubly[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+};
+
+/**
+ * Opens a stream over the file with the specified inumber.
+ * Returns 0 on success, -1 on error.
+ */
+int file_openstream(struct unixfilesystem *fs, int inumber, struct filestream *stream);
+
+/**
+ * Hands out the next run of up to maxBlocks blocks of the stream's file that
+ * are contiguous on disk, fetched with a single read.  *data is pointed at the
+ * bytes as file_getblock_ptr does; buf must have room for maxBlocks blocks.
+ * Returns the number of valid bytes in the run, 0 once the whole file has been
+ * read, -1 on error.
+ */
+int file_readstream(struct filestream *stream, int maxBlocks, void *buf, const void **data);
+
 #endif // _FILE_H_
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "filewrite.h"
+#include "alloc.h"
+#include "inode.h"
+#include "file.h"
+#include "directory.h"
+#include "diskimg.h"
+
+#define NOF_ADDRS_PER_BLOCK ((int) (DISKIMG_SECTOR_SIZE / sizeof(uint16_t)))   // 256
+#define NOF_DIRECT 8              // blocks a small file can address straight from i_addr
+#define NOF_SINGLY 7              // singly-indirect blocks a large file addresses from i_addr
+#define MAX_FILE_SIZE 0xffffff    // the size is a 24-bit number
+#define DIRENT_SIZE ((int) sizeof(struct direntv6))
+
+static int nof_blocks(int size) {
+  return (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+}
+
+static int is_directory(const struct inode *in) {
+  return (in->i_mode & IFMT) == IFDIR;
+}
+
+static void touch(struct inode *in) {
+  time_t now = time(NULL);
+  in->i_mtime[0] = (now >> 16) & 0xffff;
+  in->i_mtime[1] = now & 0xffff;
+}
+
+static void invalidate_name(struct unixfilesystem *fs, int dirinumber, const char *name) {
+  if (fs->dcache != NULL) dcache_invalidate(fs->dcache, dirinumber, name);
+  if (fs->dirindex != NULL) dirindex_invalidate(fs->dirindex, dirinumber);
+}
+
+/**
+ * Allocates a block to serve as an indirect block, and zeroes it.
+ */
+static int new_indirect(struct unixfilesystem *fs) {
+  int blockNum = alloc_block(fs);
+  if (blockNum < 0) return -1;
+  char zeros[DISKIMG_SECTOR_SIZE];
+  memset(zeros, 0, sizeof(zeros));
+  if (diskimg_writesector_ordered(fs->dfd, blockNum, zeros, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+    return -1;
+  }
+  return blockNum;
+}
+
+/**
+ * Returns entry index of indirect block indirectBlock, filling it in first
+ * with a newly allocated block if it's 0: an indirect block (zeroed) if
+ * isIndirect is set, a data block otherwise, in which case *fresh is set so
+ * the caller knows the block's old contents mean nothing.  Returns -1 on
+ * error.
+ */
+static int ensure_entry(struct unixfilesystem *fs, int indirectBlock, int index, int isIndirect, int *fresh) {
+  uint16_t buf[NOF_ADDRS_PER_BLOCK];
+  const uint16_t *list = diskimg_getsector_ptr(fs->dfd, indirectBlock, buf);
+  if (list == NULL) return -1;
+  *fresh = 0;
+  if (list[index] != 0) return list[index];
+
+  int blockNum = isIndirect ? new_indirect(fs) : alloc_block(fs);
+  if (blockNum < 0) return -1;
+  if (list != buf) memcpy(buf, list, sizeof(buf));
+  buf[index] = blockNum;
+  if (diskimg_writesector_ordered(fs->dfd, indirectBlock, buf, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+    return -1;
+  }
+  *fresh = !isIndirect;
+  return blockNum;
+}
+
+/**
+ * Like inode_indexlookup, but gives the file a block (and the indirect blocks
+ * leading to it) if it has none there yet.  in is updated; the caller writes
+ * it back.  A small file must already have been converted if blockNum is
+ * past what it can address.
+ */
+static int bmap(struct unixfilesystem *fs, struct inode *in, int blockNum, int *fresh) {
+  *fresh = 0;
+  if ((in->i_mode & ILARG) == 0) {
+    if (in->i_addr[blockNum] == 0) {
+      int newBlock = alloc_block(fs);
+      if (newBlock < 0) return -1;
+      in->i_addr[blockNum] = newBlock;
+      *fresh = 1;
+    }
+    return in->i_addr[blockNum];
+  }
+
+  int indirectIndex = blockNum / NOF_ADDRS_PER_BLOCK;
+  int slot = indirectIndex < NOF_SINGLY ? indirectIndex : NOF_SINGLY;
+  if (in->i_addr[slot] == 0) {
+    int newBlock = new_indirect(fs);
+    if (newBlock < 0) return -1;
+    in->i_addr[slot] = newBlock;
+  }
+  int singly = in->i_addr[slot];
+  if (indirectIndex >= NOF_SINGLY) {
+    // i_addr[7] is the doubly-indirect block
+    int unused;
+    singly = ensure_entry(fs, singly, indirectIndex - NOF_SINGLY, 1, &unused);
+    if (singly < 0) return -1;
+  }
+  return ensure_entry(fs, singly, blockNum % NOF_ADDRS_PER_BLOCK, 0, fresh);
+}
+
+/**
+ * Switches a small file to large addressing: its (up to 8) block numbers move
+ * into a new indirect block, which becomes i_addr[0].
+ */
+static int convert_to_large(struct unixfilesystem *fs, struct inode *in) {
+  int blockNum = alloc_block(fs);
+  if (blockNum < 0) return -1;
+  uint16_t list[NOF_ADDRS_PER_BLOCK];
+  memset(list, 0, sizeof(list));
+  memcpy(list, in->i_addr, sizeof(in->i_addr));
+  if (diskimg_writesector_ordered(fs->dfd, blockNum, list, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+    return -1;
+  }
+  memset(in->i_addr, 0, sizeof(in->i_addr));
+  in->i_addr[0] = blockNum;
+  in->i_mode |= ILARG;
+  return 0;
+}
+
+/**
+ * Writes len bytes of buf (zeros if buf is NULL) at offset into the file
+ * whose inode is in, allocating blocks as needed.  The size isn't touched.
+ */
+static int write_range(struct unixfilesystem *fs, struct inode *in, int offset, const char *buf, int len) {
+  int order = is_directory(in) ? DISKIMG_ORDER_DIRECTORY : DISKIMG_ORDER_DATA;
+  for (int pos = offset; pos < offset + len; ) {
+    int blockNum = pos / DISKIMG_SECTOR_SIZE;
+    int within = pos % DISKIMG_SECTOR_SIZE;
+    int n = DISKIMG_SECTOR_SIZE - within < offset + len - pos ? DISKIMG_SECTOR_SIZE - within : offset + len - pos;
+    if (blockNum >= NOF_DIRECT && (in->i_mode & ILARG) == 0 && convert_to_large(fs, in) < 0) return -1;
+    int fresh;
+    int sector = bmap(fs, in, blockNum, &fresh);
+    if (sector < 0) return -1;
+
+    char block[DISKIMG_SECTOR_SIZE];
+    if (n < DISKIMG_SECTOR_SIZE) {
+      // keep the rest of the block, unless it was only just allocated
+      const void *old = fresh ? NULL : diskimg_getsector_ptr(fs->dfd, sector, block);
+      if (fresh) memset(block, 0, sizeof(block));
+      else if (old == NULL) return -1;
+      else if (old != block) memcpy(block, old, sizeof(block));
+    }
+    if (buf != NULL) memcpy(block + within, buf + (pos - offset), n);
+    else memset(block + within, 0, n);
+    if (diskimg_writesector_ordered(fs->dfd, sector, block, order) != DISKIMG_SECTOR_SIZE) return -1;
+    pos += n;
+  }
+  return 0;
+}
+
+/**
+ * Releases the file's blocks from block keep up to block have, and the
+ * indirect blocks that no longer address anything.
+ */
+static int free_blocks(struct unixfilesystem *fs, struct inode *in, int keep, int have) {
+  if (keep >= have) return 0;
+  if ((in->i_mode & ILARG) == 0) {
+    for (int b = keep; b < have && b < NOF_DIRECT; b++) {
+      if (in->i_addr[b] != 0 && alloc_freeblock(fs, in->i_addr[b]) < 0) return -1;
+      in->i_addr[b] = 0;
+    }
+    return 0;
+  }
+
+  uint16_t doubly[NOF_ADDRS_PER_BLOCK];
+  int doublyLoaded = 0, doublyChanged = 0;
+  int numIndirect = (have + NOF_ADDRS_PER_BLOCK - 1) / NOF_ADDRS_PER_BLOCK;
+  for (int k = 0; k < numIndirect; k++) {
+    int first = k * NOF_ADDRS_PER_BLOCK;   // first file block this indirect block addresses
+    if (first + NOF_ADDRS_PER_BLOCK <= keep) continue;
+    uint16_t *singly;
+    if (k < NOF_SINGLY) {
+      singly = &in->i_addr[k];
+    } else {
+      if (!doublyLoaded) {
+        if (in->i_addr[NOF_SINGLY] == 0) break;
+        const void *block = diskimg_getsector_ptr(fs->dfd, in->i_addr[NOF_SINGLY], doubly);
+        if (block == NULL) return -1;
+        if (block != doubly) memcpy(doubly, block, sizeof(doubly));
+        doublyLoaded = 1;
+      }
+      singly = &doubly[k - NOF_SINGLY];
+    }
+    if (*singly == 0) continue;
+
+    uint16_t list[NOF_ADDRS_PER_BLOCK];
+    const void *block = diskimg_getsector_ptr(fs->dfd, *singly, list);
+    if (block == NULL) return -1;
+    if (block != list) memcpy(list, block, sizeof(list));
+    int from = keep > first ? keep - first : 0;
+    int to = have - first < NOF_ADDRS_PER_BLOCK ? have - first : NOF_ADDRS_PER_BLOCK;
+    for (int j = from; j < to; j++) {
+      if (list[j] != 0 && alloc_freeblock(fs, list[j]) < 0) return -1;
+      list[j] = 0;
+    }
+    if (from == 0) {
+      if (alloc_freeblock(fs, *singly) < 0) return -1;
+      *singly = 0;
+      doublyChanged |= k >= NOF_SINGLY;
+    } else if (diskimg_writesector_ordered(fs->dfd, *singly, list, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+      return -1;
+    }
+  }
+
+  if (doublyLoaded && keep <= NOF_SINGLY * NOF_ADDRS_PER_BLOCK) {
+    if (alloc_freeblock(fs, in->i_addr[NOF_SINGLY]) < 0) return -1;
+    in->i_addr[NOF_SINGLY] = 0;
+  } else if (doublyChanged &&
+             diskimg_writesector_ordered(fs->dfd, in->i_addr[NOF_SINGLY], doubly, DISKIMG_ORDER_INDIRECT) != DISKIMG_SECTOR_SIZE) {
+    return -1;
+  }
+  if (keep == 0) in->i_mode &= ~ILARG;
+  return 0;
+}
+
+int file_write(struct unixfilesystem *fs, int inumber, int offset, const void *buf, int len) {
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0 || (in.i_mode & IALLOC) == 0) return -1;
+  if (offset < 0 || len < 0 || offset > MAX_FILE_SIZE - len) {
+    fprintf(stderr, "file_write: %d bytes at %d don't fit in a file\n", len, offset);
+    return -1;
+  }
+
+  int size = inode_getsize(&in);
+  int err = 0;
+  if (offset > size) err = write_range(fs, &in, size, NULL, offset - size);
+  if (err == 0) err = write_range(fs, &in, offset, buf, len);
+  if (err == 0 && offset + len > size) inode_setsize(&in, offset + len);
+  // a failed write leaves the size alone, so the blocks it added past the end go back
+  if (err < 0) free_blocks(fs, &in, nof_blocks(size), nof_blocks(offset + len));
+  touch(&in);
+  if (inode_iput(fs, inumber, &in) < 0) err = -1;
+  return err == 0 ? len : -1;
+}
+
+int file_truncate(struct unixfilesystem *fs, int inumber, int size) {
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0 || (in.i_mode & IALLOC) == 0) return -1;
+  if (size < 0 || size > MAX_FILE_SIZE) return -1;
+
+  int oldSize = inode_getsize(&in);
+  int err;
+  if (size > oldSize) {
+    err = write_range(fs, &in, oldSize, NULL, size - oldSize);
+    if (err < 0) free_blocks(fs, &in, nof_blocks(oldSize), nof_blocks(size));
+  } else {
+    err = free_blocks(fs, &in, nof_blocks(size), nof_blocks(oldSize));
+  }
+  if (err == 0) inode_setsize(&in, size);
+  touch(&in);
+  if (inode_iput(fs, inumber, &in) < 0) err = -1;
+  return err;
+}
+
+/**
+ * Undoes a file_create that failed before the new inode got its entry: the
+ * inode's blocks go back on the free list, and the inode itself is cleared
+ * and freed.  A new inode is small, so its blocks are all in i_addr.
+ */
+static void discard_inode(struct unixfilesystem *fs, int inumber, struct inode *in) {
+  free_blocks(fs, in, 0, NOF_DIRECT);
+  memset(in, 0, sizeof(*in));
+  inode_iput(fs, inumber, in);
+  alloc_freeinode(fs, inumber);
+}
+
+int file_create(struct unixfilesystem *fs, int dirinumber, const char *name, int mode) {
+  struct direntv6 entry;
+  int nameLength = strlen(name);
+  if (nameLength == 0 || nameLength > (int) sizeof(entry.d_name) || strchr(name, '/') != NULL ||
+      strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+    fprintf(stderr, "file_create: bad name %s\n", name);
+    return -1;
+  }
+  struct inode dir;
+  if (inode_iget(fs, dirinumber, &dir) < 0 || !is_directory(&dir)) return -1;
+  int found = directory_findname(fs, name, dirinumber, &entry);
+  if (found != -1) {
+    if (found == 0) fprintf(stderr, "file_create: %s already exists\n", name);
+    return -1;
+  }
+
+  int inumber = alloc_inode(fs);
+  if (inumber < 0) return -1;
+  struct inode in;
+  memset(&in, 0, sizeof(in));
+  in.i_mode = IALLOC | (mode & (IFMT | 07777));
+  in.i_nlink = 1;
+  touch(&in);
+  memcpy(in.i_atime, in.i_mtime, sizeof(in.i_atime));
+  if (is_directory(&in)) {
+    struct direntv6 dots[2];
+    memset(dots, 0, sizeof(dots));
+    dots[0].d_inumber = inumber;
+    strcpy(dots[0].d_name, ".");
+    dots[1].d_inumber = dirinumber;
+    strcpy(dots[1].d_name, "..");
+    if (write_range(fs, &in, 0, (const char *) dots, sizeof(dots)) < 0) {
+      discard_inode(fs, inumber, &in);
+      return -1;
+    }
+    inode_setsize(&in, sizeof(dots));
+    in.i_nlink = 2;
+  }
+  // the inode is written before the entry that names it
+  if (inode_iput(fs, inumber, &in) < 0) {
+    discard_inode(fs, inumber, &in);
+    return -1;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.d_inumber = inumber;
+  strncpy(entry.d_name, name, sizeof(entry.d_name));
+  int err = file_write(fs, dirinumber, inode_getsize(&dir), &entry, sizeof(entry)) < 0 ? -1 : 0;
+  invalidate_name(fs, dirinumber, name);
+  if (err < 0) {
+    discard_inode(fs, inumber, &in);
+    return -1;
+  }
+  if (is_directory(&in)) {
+    // the new directory's ".." links to its parent
+    err = inode_iget(fs, dirinumber, &dir);
+    if (err == 0) {
+      dir.i_nlink++;
+      err = inode_iput(fs, dirinumber, &dir);
+    }
+  }
+  return err == 0 ? inumber : -1;
+}
+
+/**
+ * Finds the entry called name in directory dirinumber.  Returns its index
+ * among the directory's entries and fills in *entry, or returns -1.
+ */
+static int find_slot(struct unixfilesystem *fs, int dirinumber, const char *name, struct direntv6 *entry) {
+  struct filestream stream;
+  if (file_openstream(fs, dirinumber, &stream) < 0) return -1;
+  char buf[DISKIMG_SECTOR_SIZE];
+  const void *block;
+  int nbytes, index = 0;
+  while ((nbytes = file_readstream(&stream, 1, buf, &block)) > 0) {
+    const struct direntv6 *entries = block;
+    for (int i = 0; i < nbytes / DIRENT_SIZE; i++, index++) {
+      if (strncmp(name, entries[i].d_name, sizeof(entries[i].d_name)) == 0) {
+        *entry = entries[i];
+        return index;
+      }
+    }
+  }
+  return -1;
+}
+
+int file_unlink(struct unixfilesystem *fs, int dirinumber, const char *name) {
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+  struct inode dir;
+  if (inode_iget(fs, dirinumber, &dir) < 0 || !is_directory(&dir)) return -1;
+  struct direntv6 entry;
+  int slot = find_slot(fs, dirinumber, name, &entry);
+  if (slot < 0) return -1;
+  int inumber = entry.d_inumber;
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0) return -1;
+  int isDirectory = is_directory(&in);
+  if (isDirectory && inode_getsize(&in) > 2 * DIRENT_SIZE) {
+    fprintf(stderr, "file_unlink: directory %s isn't empty\n", name);
+    return -1;
+  }
+
+  // move the last entry into the slot, then drop the last slot
+  int numEntries = inode_getsize(&dir) / DIRENT_SIZE;
+  if (slot != numEntries - 1) {
+    int lastOffset = (numEntries - 1) * DIRENT_SIZE;
+    char buf[DISKIMG_SECTOR_SIZE];
+    if (file_getblock(fs, dirinumber, lastOffset / DISKIMG_SECTOR_SIZE, buf) < 0) return -1;
+    if (file_write(fs, dirinumber, slot * DIRENT_SIZE, buf + lastOffset % DISKIMG_SECTOR_SIZE, DIRENT_SIZE) < 0) {
+      return -1;
+    }
+  }
+  int err = file_truncate(fs, dirinumber, (numEntries - 1) * DIRENT_SIZE);
+  invalidate_name(fs, dirinumber, name);
+  if (err < 0) return -1;
+
+  if (isDirectory) {
+    // its ".." no longer links to the parent, and its own entries are gone
+    if (inode_iget(fs, dirinumber, &dir) < 0) return -1;
+    dir.i_nlink--;
+    if (inode_iput(fs, dirinumber, &dir) < 0) return -1;
+    invalidate_name(fs, inumber, ".");
+    invalidate_name(fs, inumber, "..");
+  }
+  if (!isDirectory && in.i_nlink > 1) {
+    in.i_nlink--;
+    return inode_iput(fs, inumber, &in);
+  }
+
+  // that was the last link: release the blocks, then the inode
+  if (file_truncate(fs, inumber, 0) < 0) return -1;
+  memset(&in, 0, sizeof(in));
+  if (inode_iput(fs, inumber, &in) < 0) return -1;
+  alloc_freeinode(fs, inumber);
+  return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef _FILEWRITE_H_
+#define _FILEWRITE_H_
+
+#include "unixfilesystem.h"
+
+/**
+ * Operations that change the filesystem.  Blocks and inodes come from the
+ * superblock's free lists (see alloc.h), and every changed sector is written
+ * with the diskimg order matching its role, so on an image opened with
+ * DISKIMG_WRITEBACK the changes pile up in the sector cache and reach the
+ * disk at the next unixfilesystem_sync: file contents first, then indirect
+ * blocks, inodes, directories and finally the superblock.
+ *
+ * Directories are kept dense: entries are appended at the end, and unlinking
+ * moves the last entry into the freed slot.  Whatever the dentry cache and
+ * directory indexes know about a changed directory is dropped, to be looked
+ * up again on next use.
+ *
+ * Allocating blocks and inodes is thread-safe (see alloc.h), but these calls
+ * update directories and inodes without any locking of their own, so they
+ * may run concurrently with lookups and reads, but not with each other.
+ */
+
+/**
+ * Creates an entry called name in directory dirinumber for a new, empty inode
+ * with the given mode (permission bits, optionally IFDIR for a directory,
+ * which gets its "." and ".." entries).  Returns the new inumber, or -1 on
+ * error, including when the name is taken.
+ */
+int file_create(struct unixfilesystem *fs, int dirinumber, const char *name, int mode);
+
+/**
+ * Writes len bytes from buf at byte offset of the file, allocating blocks as
+ * needed and growing the file if the write ends past its end.  A gap between
+ * the old end and offset is filled with zeros.  Returns len on success, -1 on
+ * error.
+ */
+int file_write(struct unixfilesystem *fs, int inumber, int offset, const void *buf, int len);
+
+/**
+ * Sets the size of the file to size bytes, releasing the blocks past the new
+ * end or zero-filling up to it.  Returns 0 on success, -1 on error.
+ */
+int file_truncate(struct unixfilesystem *fs, int inumber, int size);
+
+/**
+ * Removes the entry called name from directory dirinumber, and the inode it
+ * refers to along with its blocks once no other entry links to it.
+ * Directories can only be unlinked once empty.  Returns 0 on success, -1 on
+ * error.
+ */
+int file_unlink(struct unixfilesystem *fs, int dirinumber, const char *name);
+
+#endif // _FILEWRITE_H_
@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <assert.h>
 
 #include "inode.h"
@@ -6,9 +9,103 @@
 
 #define INODE_SIZE ((int)sizeof(struct inode))
 #define NOF_INODES_PER_BLOCK (DISKIMG_SECTOR_SIZE / sizeof(struct inode))
+#define INODE_RUN_SECTORS 16 // most inode sectors fetched with one read
 
-// remove the placeholder implementation and replace with your own
-int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+/**
+ * The inode area of the disk, kept in memory a sector at a time: the first
+ * time any inode of a sector is asked for, all 16 inodes of the sector are
+ * copied in, and every later inode_iget of them is a plain copy.
+ */
+struct inodetable
+{
+  int nof_sectors;               // s_isize
+  struct inode *inodes;          // nof_sectors * 16, inode inumber at [inumber - 1]
+  unsigned char *sector_loaded;  // per sector of the inode area
+  pthread_mutex_t lock;
+};
+
+struct inodetable *inode_createtable(int nof_sectors)
+{
+  struct inodetable *table = malloc(sizeof(struct inodetable));
+  if(table == NULL) return NULL;
+  table->nof_sectors = nof_sectors;
+  table->inodes = malloc((size_t)nof_sectors * DISKIMG_SECTOR_SIZE);
+  table->sector_loaded = calloc(nof_sectors > 0 ? nof_sectors : 1, 1);
+  if(table->inodes == NULL || table->sector_loaded == NULL)
+  {
+    free(table->inodes);
+    free(table->sector_loaded);
+    free(table);
+    return NULL;
+  }
+  pthread_mutex_init(&table->lock, NULL);
+  return table;
+}
+
+void inode_freetable(struct inodetable *table)
+{
+  if(table == NULL) return;
+  pthread_mutex_destroy(&table->lock);
+  free(table->inodes);
+  free(table->sector_loaded);
+  free(table);
+}
+
+/**
+ * Makes sectors [first_sector, first_sector + nof_sectors) of the inode area
+ * resident, reading each run of missing sectors with a single disk read (the
+ * reads happen outside the lock).  Returns how many sectors from first_sector
+ * on are resident, which is less than nof_sectors only if a read failed.
+ */
+static int inodetable_load(struct unixfilesystem *fs, int first_sector, int nof_sectors)
+{
+  struct inodetable *table = fs->inodetable;
+  int i_end = first_sector + nof_sectors;
+  int i_sector = first_sector;
+  while(i_sector < i_end)
+  {
+    pthread_mutex_lock(&table->lock);
+    while(i_sector < i_end && table->sector_loaded[i_sector]) i_sector++;
+    int i_run_start = i_sector;
+    while(i_sector < i_end && !table->sector_loaded[i_sector] && i_sector - i_run_start < INODE_RUN_SECTORS) i_sector++;
+    pthread_mutex_unlock(&table->lock);
+    int i_run_length = i_sector - i_run_start;
+    if(i_run_length == 0) break;
+
+    struct inode buffer[INODE_RUN_SECTORS * NOF_INODES_PER_BLOCK];
+    int i_nof_bytes = diskimg_readsectors(fs->dfd, INODE_START_SECTOR + i_run_start, i_run_length, buffer);
+    int i_nof_read = i_nof_bytes < 0 ? 0 : i_nof_bytes / DISKIMG_SECTOR_SIZE;
+    pthread_mutex_lock(&table->lock);
+    for(int i = 0; i < i_nof_read; i++)
+    {
+      // another thread may have loaded the sector in the meantime
+      if(table->sector_loaded[i_run_start + i]) continue;
+      memcpy(&table->inodes[(i_run_start + i) * NOF_INODES_PER_BLOCK], &buffer[i * NOF_INODES_PER_BLOCK],
+             DISKIMG_SECTOR_SIZE);
+      table->sector_loaded[i_run_start + i] = 1;
+    }
+    pthread_mutex_unlock(&table->lock);
+    if(i_nof_read < i_run_length)
+    {
+      fprintf(stderr, "inode_iget: Error reading sector %d\n", INODE_START_SECTOR + i_run_start + i_nof_read);
+      return i_run_start + i_nof_read - first_sector;
+    }
+  }
+  return nof_sectors;
+}
+
+// true if inodes [inumber, inumber + count) all live in the resident table
+static int inodetable_covers(struct unixfilesystem *fs, int inumber, int count)
+{
+  return fs->inodetable != NULL && inumber >= 1 && count >= 0 &&
+         inumber - 1 + count <= fs->inodetable->nof_sectors * (int)NOF_INODES_PER_BLOCK;
+}
+
+/**
+ * Fetches one inode straight from its sector, for when there is no resident
+ * inode table.
+ */
+static int inode_readone(struct unixfilesystem *fs, int inumber, struct inode *inp) {
   // INODE_START_SECTOR starter sector for inodes ( its num 2)
   // fs->superblock.s_isize total number of blocks of inodes 
   // each block(sector) has 512/32 = 16 inodes, so total nof inodes is fs->superblock.s_isize * 16
@@ -17,10 +114,10 @@ int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
   //   fprintf(stderr, "inorde number %d out of bound, returning -1\n", inumber);
   //   return -1;  
   // }
-  int sector_number = INODE_START_SECTOR + (inumber - 1) / INODE_SIZE;
+  int sector_number = INODE_START_SECTOR + (inumber - 1) / NOF_INODES_PER_BLOCK;
   struct inode buffer[NOF_INODES_PER_BLOCK];
-  int i_nof_bytes = diskimg_readsector(fs->dfd, sector_number, buffer);
-  if(i_nof_bytes == -1) 
+  const struct inode *inodes = diskimg_getsector_ptr(fs->dfd, sector_number, buffer);
+  if(inodes == NULL) 
   {
     fprintf(stderr, "inode_iget: Error reading sector %d, returning -1\n", sector_number);
     return -1;  
@@ -29,11 +126,76 @@ int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
   // int inode_index_in_buffer = (inumber - (sector_number - INODE_START_SECTOR) * NOF_INODES_PER_BLOCK) - 1;
   int inode_index_in_buffer = (inumber - 1) % NOF_INODES_PER_BLOCK;
 
-  *inp = buffer[inode_index_in_buffer];
+  *inp = inodes[inode_index_in_buffer];
 
   return 0;
 }
 
+int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+  if(inode_iget_range(fs, inumber, 1, inp) == 1) return 0;
+  return -1;
+}
+
+int inode_iget_range(struct unixfilesystem *fs, int inumber, int count, struct inode *inodes) {
+  if(!inodetable_covers(fs, inumber, count))
+  {
+    // no resident table (or not all of the range is in it): one sector read per inode
+    for(int i = 0; i < count; i++)
+    {
+      if(inode_readone(fs, inumber + i, &inodes[i]) == -1) return i;
+    }
+    return count;
+  }
+  if(count == 0) return 0;
+
+  struct inodetable *table = fs->inodetable;
+  int i_first_sector = (inumber - 1) / NOF_INODES_PER_BLOCK;
+  int i_last_sector = (inumber - 1 + count - 1) / NOF_INODES_PER_BLOCK;
+  int i_nof_loaded = inodetable_load(fs, i_first_sector, i_last_sector - i_first_sector + 1);
+  // inodes from inumber up to the end of the last resident sector are available
+  int i_available = (i_first_sector + i_nof_loaded) * NOF_INODES_PER_BLOCK - (inumber - 1);
+  if(i_available > count) i_available = count;
+  if(i_available < 0) i_available = 0;
+
+  pthread_mutex_lock(&table->lock);
+  memcpy(inodes, &table->inodes[inumber - 1], i_available * sizeof(struct inode));
+  pthread_mutex_unlock(&table->lock);
+  return i_available;
+}
+
+int inode_iput(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+  if(inumber < 1) return -1;
+  int sector_number = INODE_START_SECTOR + (inumber - 1) / NOF_INODES_PER_BLOCK;
+  struct inode buffer[NOF_INODES_PER_BLOCK];
+  const struct inode *inodes = diskimg_getsector_ptr(fs->dfd, sector_number, buffer);
+  if(inodes == NULL)
+  {
+    fprintf(stderr, "inode_iput: Error reading sector %d, returning -1\n", sector_number);
+    return -1;
+  }
+  if(inodes != buffer) memcpy(buffer, inodes, DISKIMG_SECTOR_SIZE);
+  buffer[(inumber - 1) % NOF_INODES_PER_BLOCK] = *inp;
+
+  // the whole updated sector goes into the table, under its lock, so a load of
+  // the same sector that started before this write can't install the old one
+  int i_covered = inodetable_covers(fs, inumber, 1);
+  if(i_covered) pthread_mutex_lock(&fs->inodetable->lock);
+  int i_nof_bytes = diskimg_writesector_ordered(fs->dfd, sector_number, buffer, DISKIMG_ORDER_INODE);
+  if(i_covered && i_nof_bytes == DISKIMG_SECTOR_SIZE)
+  {
+    int i_sector = (inumber - 1) / NOF_INODES_PER_BLOCK;
+    memcpy(&fs->inodetable->inodes[i_sector * NOF_INODES_PER_BLOCK], buffer, DISKIMG_SECTOR_SIZE);
+    fs->inodetable->sector_loaded[i_sector] = 1;
+  }
+  if(i_covered) pthread_mutex_unlock(&fs->inodetable->lock);
+  if(i_nof_bytes != DISKIMG_SECTOR_SIZE)
+  {
+    fprintf(stderr, "inode_iput: Error writing sector %d, returning -1\n", sector_number);
+    return -1;
+  }
+  return 0;
+}
+
 // remove the placeholder implementation and replace with your own
 int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
   int i_disk_block_number = -1;
@@ -50,6 +212,7 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum
     // so in total there are maximum 7 + 256 singly indirect blocks
     // block_numbers are of type uint16_t, 2 bytes
     uint16_t buff[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+    const uint16_t *block_numbers;
     int i_bocks_nums_in_indirect_block = DISKIMG_SECTOR_SIZE / sizeof(uint16_t); // 256, number of block numbers in one indirect block 
     int i_indirect_block_idx = blockNum / i_bocks_nums_in_indirect_block; // [0..263]
     int i_indirect_block_disc_number;
@@ -62,27 +225,134 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum
       // printf("ZASOOOO");
       i_indirect_block_idx -= 7;
       // read doubly indirect block to the buffer
-      int i_nof_bytes = diskimg_readsector(fs->dfd, inp->i_addr[7], buff);
-      if(i_nof_bytes == -1) 
+      block_numbers = diskimg_getsector_ptr(fs->dfd, inp->i_addr[7], buff);
+      if(block_numbers == NULL) 
       {
         fprintf(stderr, "inode_indexlookup: Error reading sector %d, returning -1\n", inp->i_addr[7]);
         return -1;  
       }
-      i_indirect_block_disc_number = buff[i_indirect_block_idx];
+      i_indirect_block_disc_number = block_numbers[i_indirect_block_idx];
     }
-    int i_nof_bytes = diskimg_readsector(fs->dfd, i_indirect_block_disc_number, buff);
-    if(i_nof_bytes == -1) 
+    block_numbers = diskimg_getsector_ptr(fs->dfd, i_indirect_block_disc_number, buff);
+    if(block_numbers == NULL) 
     {
       fprintf(stderr, "inode_indexlookup: Error reading sector %d, returning -1\n", i_indirect_block_disc_number);
       return -1;  
     }
     int i_relative_block_num_index = blockNum % i_bocks_nums_in_indirect_block; // relative index of block number in singly indirect block
-    i_disk_block_number = buff[i_relative_block_num_index];
+    i_disk_block_number = block_numbers[i_relative_block_num_index];
   }
 
   return i_disk_block_number;
 }
 
+/**
+ * Appends block blockNum, stored in sector sectorNum, to the extent map being
+ * built, extending the last extent when the block follows it on disk.
+ * Returns 0 on success, -1 if the map couldn't grow.
+ */
+static int extents_append(struct inode_extent **extents, int *nof_extents, int *capacity, int blockNum,
+                          int sectorNum)
+{
+  if(*nof_extents > 0)
+  {
+    struct inode_extent *last = &(*extents)[*nof_extents - 1];
+    if(last->sectorNum + last->numBlocks == sectorNum)
+    {
+      last->numBlocks++;
+      return 0;
+    }
+  }
+  if(*nof_extents == *capacity)
+  {
+    int i_new_capacity = *capacity == 0 ? 8 : 2 * *capacity;
+    struct inode_extent *grown = realloc(*extents, i_new_capacity * sizeof(struct inode_extent));
+    if(grown == NULL) return -1;
+    *extents = grown;
+    *capacity = i_new_capacity;
+  }
+  struct inode_extent *e = &(*extents)[(*nof_extents)++];
+  e->blockNum = blockNum;
+  e->sectorNum = sectorNum;
+  e->numBlocks = 1;
+  return 0;
+}
+
+/**
+ * Does the work of inode_getextents, leaving what it built so far in
+ * *extents on error.  Returns 0 on success, -1 on error.
+ */
+static int extents_build(struct unixfilesystem *fs, struct inode *inp, struct inode_extent **extents,
+                         int *nof_extents)
+{
+  const int i_nof_block_numbers = DISKIMG_SECTOR_SIZE / sizeof(uint16_t); // 256 per indirect block
+  int i_nof_blocks = (inode_getsize(inp) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  int i_capacity = 0;
+
+  if((inp->i_mode & ILARG) == 0)
+  {
+    for(int i = 0; i < i_nof_blocks && i < 8; i++)
+    {
+      if(extents_append(extents, nof_extents, &i_capacity, i, inp->i_addr[i]) < 0) return -1;
+    }
+    return 0;
+  }
+
+  // walk the singly-indirect blocks in file order: the first 7 come straight
+  // from i_addr, the rest through the doubly-indirect block
+  uint16_t doubly_buff[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+  const uint16_t *doubly = NULL;
+  uint16_t buff[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+  int i_nof_indirect = (i_nof_blocks + i_nof_block_numbers - 1) / i_nof_block_numbers;
+  for(int k = 0; k < i_nof_indirect; k++)
+  {
+    int i_indirect_sector;
+    if(k < 7)
+    {
+      i_indirect_sector = inp->i_addr[k];
+    }
+    else
+    {
+      if(doubly == NULL) doubly = diskimg_getsector_ptr(fs->dfd, inp->i_addr[7], doubly_buff);
+      if(doubly == NULL)
+      {
+        fprintf(stderr, "inode_getextents: Error reading sector %d, returning -1\n", inp->i_addr[7]);
+        return -1;
+      }
+      i_indirect_sector = doubly[k - 7];
+    }
+    const uint16_t *block_numbers = diskimg_getsector_ptr(fs->dfd, i_indirect_sector, buff);
+    if(block_numbers == NULL)
+    {
+      fprintf(stderr, "inode_getextents: Error reading sector %d, returning -1\n", i_indirect_sector);
+      return -1;
+    }
+    int i_first_block = k * i_nof_block_numbers;
+    for(int i = 0; i < i_nof_block_numbers && i_first_block + i < i_nof_blocks; i++)
+    {
+      if(extents_append(extents, nof_extents, &i_capacity, i_first_block + i, block_numbers[i]) < 0) return -1;
+    }
+  }
+  return 0;
+}
+
+int inode_getextents(struct unixfilesystem *fs, struct inode *inp, struct inode_extent **extents) {
+  int i_nof_extents = 0;
+  *extents = NULL;
+  if(extents_build(fs, inp, extents, &i_nof_extents) < 0)
+  {
+    free(*extents);
+    *extents = NULL;
+    return -1;
+  }
+  return i_nof_extents;
+}
+
 int inode_getsize(struct inode *inp) {
   return ((inp->i_size0 << 16) | inp->i_size1);
 }
+
+void inode_setsize(struct inode *inp, int size) {
+  inp->i_size0 = (size >> 16) & 0xff;
+  inp->i_size1 = size & 0xffff;
+}
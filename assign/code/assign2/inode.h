@@ -9,6 +9,33 @@
  */
 int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp); 
 
+/**
+ * Fetches count consecutive inodes starting at inumber into inodes, reading
+ * every inode sector they span that isn't resident yet with as few disk reads
+ * as possible.  Returns the number of inodes fetched, which is less than
+ * count only if a sector couldn't be read.
+ */
+int inode_iget_range(struct unixfilesystem *fs, int inumber, int count, struct inode *inodes);
+
+/**
+ * Writes inp back as the inode with the specified inumber, through the sector
+ * cache (see diskimg_writesector_ordered) and the resident inode table.
+ * Returns 0 on success, -1 on error.
+ */
+int inode_iput(struct unixfilesystem *fs, int inumber, struct inode *inp);
+
+/**
+ * Creates the resident inode table for an inode area of nof_sectors sectors,
+ * which inode_iget and inode_iget_range fill in as inodes are asked for.
+ * Returns NULL on error.
+ */
+struct inodetable *inode_createtable(int nof_sectors);
+
+/**
+ * Releases a table returned by inode_createtable.
+ */
+void inode_freetable(struct inodetable *table);
+
 /**
  * Given an index of a file block, retrieves the file's actual block number
  * of from the given inode.
@@ -17,9 +44,35 @@ int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp);
  */
 int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum);
 
+/**
+ * A run of file blocks that sit next to each other on disk: blocks
+ * [blockNum, blockNum + numBlocks) of the file are sectors
+ * [sectorNum, sectorNum + numBlocks).
+ */
+struct inode_extent {
+  int blockNum;
+  int sectorNum;
+  int numBlocks;
+};
+
+/**
+ * Builds the extent map of the given inode: the fewest extents that cover all
+ * of the file's blocks, in file order, so a contiguous file comes back as a
+ * single extent.  Each indirect block is read once.  *extents is pointed at
+ * an array the caller must free (NULL for an empty file).
+ *
+ * Returns the number of extents, -1 on error.
+ */
+int inode_getextents(struct unixfilesystem *fs, struct inode *inp, struct inode_extent **extents);
+
 /**
  * Computes the size in bytes of the file identified by the given inode
  */
 int inode_getsize(struct inode *inp);
 
+/**
+ * Stores size, which must fit in 24 bits, as the size of the given inode.
+ */
+void inode_setsize(struct inode *inp, int size);
+
 #endif // _INODE_
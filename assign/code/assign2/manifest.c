@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "manifest.h"
+#include "inode.h"
+#include "diskimg.h"
+#include "chksumfile.h"
+
+/**
+ * The sidecar file is text: a header line
+ *   v6manifest 1 <engine>
+ * followed by one line per remembered inode
+ *   <inumber> <mtime[0]> <mtime[1]> <size> <block map hash> <checksum>
+ * with the hash and checksum in hex.
+ */
+#define MANIFEST_MAGIC "v6manifest"
+#define MANIFEST_VERSION 1
+
+struct manifestentry {
+  int valid;
+  uint16_t mtime[2];
+  int size;
+  uint64_t mapHash;
+  unsigned char chksum[CHKSUMFILE_SIZE];
+};
+
+struct manifest {
+  int numInodes;
+  struct manifestentry *entries;   // inode inumber at [inumber - 1]
+  struct manifest_stats stats;
+  pthread_mutex_t lock;
+};
+
+static uint64_t fnv64(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+/**
+ * Hashes in's block map: its mode, i_addr, and each indirect block the file
+ * uses.  Returns 0 on success, -1 if an indirect block couldn't be read.
+ */
+static int blockmap_hash(struct unixfilesystem *fs, struct inode *in, uint64_t *hash) {
+  uint64_t h = 14695981039346656037ULL;
+  h = fnv64(h, &in->i_mode, sizeof(in->i_mode));
+  h = fnv64(h, in->i_addr, sizeof(in->i_addr));
+  if (in->i_mode & ILARG) {
+    const int perBlock = DISKIMG_SECTOR_SIZE / sizeof(uint16_t);
+    int numBlocks = (inode_getsize(in) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    int numIndirect = (numBlocks + perBlock - 1) / perBlock;   // singly-indirect blocks in use
+    char buf[DISKIMG_SECTOR_SIZE], doublyBuf[DISKIMG_SECTOR_SIZE];
+    for (int k = 0; k < numIndirect && k < 7; k++) {
+      const void *block = diskimg_getsector_ptr(fs->dfd, in->i_addr[k], buf);
+      if (block == NULL) return -1;
+      h = fnv64(h, block, DISKIMG_SECTOR_SIZE);
+    }
+    if (numIndirect > 7) {
+      const uint16_t *doubly = diskimg_getsector_ptr(fs->dfd, in->i_addr[7], doublyBuf);
+      if (doubly == NULL) return -1;
+      h = fnv64(h, doubly, DISKIMG_SECTOR_SIZE);
+      for (int k = 0; k < numIndirect - 7 && k < perBlock; k++) {
+        const void *block = diskimg_getsector_ptr(fs->dfd, doubly[k], buf);
+        if (block == NULL) return -1;
+        h = fnv64(h, block, DISKIMG_SECTOR_SIZE);
+      }
+    }
+  }
+  *hash = h;
+  return 0;
+}
+
+static struct manifest *manifest_create(int numInodes) {
+  struct manifest *m = malloc(sizeof(struct manifest));
+  if (m == NULL) return NULL;
+  m->numInodes = numInodes > 0 ? numInodes : 0;
+  m->entries = calloc(m->numInodes > 0 ? m->numInodes : 1, sizeof(struct manifestentry));
+  if (m->entries == NULL) {
+    free(m);
+    return NULL;
+  }
+  memset(&m->stats, 0, sizeof(m->stats));
+  pthread_mutex_init(&m->lock, NULL);
+  return m;
+}
+
+static int parse_hex(const char *s, unsigned char *bytes, int len) {
+  if ((int) strlen(s) != 2 * len) return -1;
+  for (int i = 0; i < len; i++) {
+    unsigned int byte;
+    if (sscanf(s + 2 * i, "%2x", &byte) != 1) return -1;
+    bytes[i] = byte;
+  }
+  return 0;
+}
+
+struct manifest *manifest_load(const char *path, int numInodes) {
+  struct manifest *m = manifest_create(numInodes);
+  if (m == NULL) return NULL;
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    if (errno == ENOENT) return m;   // first run: nothing remembered yet
+    manifest_free(m);
+    return NULL;
+  }
+
+  char magic[16], engine[16];
+  int version;
+  if (fscanf(f, "%15s %d %15s", magic, &version, engine) != 3 ||
+      strcmp(magic, MANIFEST_MAGIC) != 0 || version != MANIFEST_VERSION) {
+    fclose(f);
+    manifest_free(m);
+    return NULL;
+  }
+  if (strcmp(engine, chksumfile_enginename()) != 0) {
+    // checksums made by another engine are no use
+    fclose(f);
+    return m;
+  }
+
+  struct manifestentry e;
+  int inumber;
+  unsigned int mtime0, mtime1;
+  unsigned long long mapHash;
+  char hex[CHKSUMFILE_STRINGSIZE];
+  int n;
+  while ((n = fscanf(f, "%d %u %u %d %llx %128s", &inumber, &mtime0, &mtime1, &e.size, &mapHash, hex)) == 6) {
+    if (parse_hex(hex, e.chksum, chksumfile_size()) < 0) break;
+    if (inumber < 1 || inumber > m->numInodes) continue;
+    e.valid = 1;
+    e.mtime[0] = mtime0;
+    e.mtime[1] = mtime1;
+    e.mapHash = mapHash;
+    m->entries[inumber - 1] = e;
+  }
+  int bad = n != EOF || ferror(f);
+  fclose(f);
+  if (bad) {
+    manifest_free(m);
+    return NULL;
+  }
+  return m;
+}
+
+int manifest_chksum(struct manifest *m, struct unixfilesystem *fs, int inumber, void *chksum) {
+  struct inode in;
+  if (inumber < 1 || inumber > m->numInodes || inode_iget(fs, inumber, &in) < 0) {
+    return chksumfile_byinumber(fs, inumber, chksum);
+  }
+  uint64_t mapHash;
+  int haveMap = blockmap_hash(fs, &in, &mapHash) == 0;
+  int size = inode_getsize(&in);
+
+  pthread_mutex_lock(&m->lock);
+  struct manifestentry e = m->entries[inumber - 1];
+  pthread_mutex_unlock(&m->lock);
+  if (haveMap && (in.i_mode & IALLOC) && e.valid && e.size == size && e.mapHash == mapHash &&
+      memcmp(e.mtime, in.i_mtime, sizeof(e.mtime)) == 0) {
+    memcpy(chksum, e.chksum, chksumfile_size());
+    pthread_mutex_lock(&m->lock);
+    m->stats.reused++;
+    pthread_mutex_unlock(&m->lock);
+    return chksumfile_size();
+  }
+
+  int len = chksumfile_byinumber(fs, inumber, chksum);
+  e.valid = haveMap && len >= 0;
+  if (e.valid) {
+    memcpy(e.mtime, in.i_mtime, sizeof(e.mtime));
+    e.size = size;
+    e.mapHash = mapHash;
+    memcpy(e.chksum, chksum, len);
+  }
+  pthread_mutex_lock(&m->lock);
+  m->entries[inumber - 1] = e;
+  m->stats.rehashed++;
+  pthread_mutex_unlock(&m->lock);
+  return len;
+}
+
+int manifest_save(struct manifest *m, const char *path) {
+  // write a new file next to the old one and rename it over, so a crash
+  // midway leaves the previous manifest intact
+  char *tmppath = malloc(strlen(path) + sizeof(".tmp"));
+  if (tmppath == NULL) return -1;
+  sprintf(tmppath, "%s.tmp", path);
+  FILE *f = fopen(tmppath, "w");
+  if (f == NULL) {
+    free(tmppath);
+    return -1;
+  }
+
+  fprintf(f, "%s %d %s\n", MANIFEST_MAGIC, MANIFEST_VERSION, chksumfile_enginename());
+  pthread_mutex_lock(&m->lock);
+  for (int i = 0; i < m->numInodes; i++) {
+    struct manifestentry *e = &m->entries[i];
+    if (!e->valid) continue;
+    char hex[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string(e->chksum, hex);
+    fprintf(f, "%d %u %u %d %016llx %s\n", i + 1, e->mtime[0], e->mtime[1], e->size,
+            (unsigned long long) e->mapHash, hex);
+  }
+  pthread_mutex_unlock(&m->lock);
+
+  int err = ferror(f);
+  if (fclose(f) != 0) err = 1;
+  if (err == 0) err = rename(tmppath, path);
+  if (err != 0) unlink(tmppath);
+  free(tmppath);
+  return err == 0 ? 0 : -1;
+}
+
+void manifest_getstats(struct manifest *m, struct manifest_stats *stats) {
+  pthread_mutex_lock(&m->lock);
+  *stats = m->stats;
+  pthread_mutex_unlock(&m->lock);
+}
+
+void manifest_free(struct manifest *m) {
+  if (m == NULL) return;
+  pthread_mutex_destroy(&m->lock);
+  free(m->entries);
+  free(m);
+}
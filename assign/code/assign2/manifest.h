@@ -0,0 +1,62 @@
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+#include <stdint.h>
+
+#include "unixfilesystem.h"
+
+/**
+ * A checksum manifest remembers, for every inode it has checksummed, the
+ * inode's modification time, size, a hash of its block map and the checksum
+ * itself, and is kept in a sidecar file between runs.  When an inode's
+ * metadata and block map are unchanged since the manifest last saw it, the
+ * remembered checksum is handed back without reading the file's data.
+ *
+ * The block map hash covers the inode's mode, its i_addr array and every
+ * indirect block the file uses, so a file rewritten into different blocks is
+ * caught even if its mtime wasn't updated.  A file rewritten in place, with
+ * the same mtime, size and blocks, is not.
+ *
+ * A manifest is tied to the checksum engine it was made with; loading one
+ * made with another engine starts from scratch.  manifest_chksum may be
+ * called from several threads at once.
+ */
+struct manifest;
+
+struct manifest_stats {
+  uint64_t reused;     // checksums handed back from the manifest
+  uint64_t rehashed;   // checksums that had to be computed
+};
+
+/**
+ * Loads the manifest kept in the file at path, for a filesystem with
+ * numInodes inodes.  A missing file, or one made with a different checksum
+ * engine, gives an empty manifest.  Returns NULL if the file exists but can't
+ * be parsed, or on an allocation failure.
+ */
+struct manifest *manifest_load(const char *path, int numInodes);
+
+/**
+ * Computes the checksum of inode inumber like chksumfile_byinumber does,
+ * reusing the remembered one if the inode hasn't changed, and remembers the
+ * result.  Returns the length of the checksum, or -1 on error.
+ */
+int manifest_chksum(struct manifest *m, struct unixfilesystem *fs, int inumber, void *chksum);
+
+/**
+ * Writes the manifest to the file at path, replacing it atomically.
+ * Returns 0 on success, -1 on error.
+ */
+int manifest_save(struct manifest *m, const char *path);
+
+/**
+ * Copies the manifest's counters into stats.
+ */
+void manifest_getstats(struct manifest *m, struct manifest_stats *stats);
+
+/**
+ * Releases the manifest.
+ */
+void manifest_free(struct manifest *m);
+
+#endif // _MANIFEST_H_
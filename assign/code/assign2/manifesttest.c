@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "filewrite.h"
+#include "alloc.h"
+#include "testdisk.h"
+
+/**
+ * manifesttest runs ./diskimageaccess -M on an image it has built, changing
+ * the image between runs, and checks what the -s counters say was reused and
+ * recomputed: everything is reused on an unchanged image, exactly the inodes
+ * whose mtime, size or block map changed are recomputed, and a manifest made
+ * with another -a engine is ignored.  Every run's output must match a run
+ * without a manifest, and one that reuses everything must read fewer sectors.
+ */
+#define NUM_SECTORS 2000
+#define NUM_INODE_SECTORS 4
+#define NUM_ALLOCATED 6          // the root, /a, /b, /c, /d and /d/e, as -i dumps them
+
+#define CHECK TESTDISK_CHECK
+
+static const char *diskimageaccess = "./diskimageaccess";
+static char imagepath[TESTDISK_PATHSIZE];
+static char manifestpath[TESTDISK_PATHSIZE + 16];
+static char dirpath[TESTDISK_PATHSIZE];
+
+/**
+ * What one run printed: its stdout, and the counters -s wrote to stderr.
+ */
+struct run {
+  char *out;
+  int ok;                        // exited successfully and printed the counters
+  unsigned long long misses;     // sector cache misses
+  unsigned long long reused;     // manifest counters, if -M was given
+  unsigned long long recomputed;
+};
+
+static char *ReadFile(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) return NULL;
+  char *contents = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&contents, &size);
+  char buf[4096];
+  size_t n;
+  while (out != NULL && (n = fread(buf, 1, sizeof(buf), f)) > 0) fwrite(buf, 1, n, out);
+  fclose(f);
+  if (out != NULL) fclose(out);
+  return contents;
+}
+
+/**
+ * Runs diskimageaccess -q -s on the image with the given dump flag (-i or
+ * -p), checksum engine, and manifest if useManifest is set.
+ */
+static struct run RunAccess(const char *dumpFlag, const char *engine, int useManifest) {
+  struct run run = { NULL, 0, 0, 0, 0 };
+  char outpath[TESTDISK_PATHSIZE + 8], errpath[TESTDISK_PATHSIZE + 8];
+  snprintf(outpath, sizeof(outpath), "%s/out", dirpath);
+  snprintf(errpath, sizeof(errpath), "%s/err", dirpath);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int outfd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int errfd = open(errpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (outfd < 0 || errfd < 0 || dup2(outfd, STDOUT_FILENO) < 0 || dup2(errfd, STDERR_FILENO) < 0) _exit(EXIT_FAILURE);
+    if (useManifest) {
+      execl(diskimageaccess, diskimageaccess, "-q", "-s", dumpFlag, "-a", engine, "-M", manifestpath, imagepath,
+            (char *) NULL);
+    } else {
+      execl(diskimageaccess, diskimageaccess, "-q", "-s", dumpFlag, "-a", engine, imagepath, (char *) NULL);
+    }
+    _exit(EXIT_FAILURE);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return run;
+
+  run.out = ReadFile(outpath);
+  char *err = ReadFile(errpath);
+  const char *cache = err == NULL ? NULL : strstr(err, "Sector cache: ");
+  const char *manifest = err == NULL ? NULL : strstr(err, "Manifest: ");
+  unsigned long long hits;
+  run.ok = run.out != NULL && cache != NULL && sscanf(cache, "Sector cache: %llu hits, %llu misses", &hits, &run.misses) == 2;
+  if (useManifest) {
+    run.ok = run.ok && manifest != NULL &&
+             sscanf(manifest, "Manifest: %llu checksums reused, %llu recomputed", &run.reused, &run.recomputed) == 2;
+  }
+  free(err);
+  unlink(outpath);
+  unlink(errpath);
+  return run;
+}
+
+/**
+ * Runs the -i dump with the manifest and checks the counters, and that the
+ * output is what a run without the manifest prints.  Returns the run.
+ */
+static struct run CheckRun(const char *engine, int reused, int recomputed) {
+  struct run plain = RunAccess("-i", engine, 0);
+  struct run run = RunAccess("-i", engine, 1);
+  if (CHECK(plain.ok && run.ok)) {
+    CHECK(run.reused == (unsigned long long) reused);
+    CHECK(run.recomputed == (unsigned long long) recomputed);
+    CHECK(strcmp(run.out, plain.out) == 0);
+  }
+  free(plain.out);
+  return run;
+}
+
+static struct unixfilesystem *OpenImage(int *fd) {
+  *fd = diskimg_open(imagepath, 0);
+  return *fd < 0 ? NULL : unixfilesystem_init(*fd);
+}
+
+static int CloseImage(struct unixfilesystem *fs, int fd) {
+  int err = unixfilesystem_sync(fs);
+  unixfilesystem_free(fs);
+  if (diskimg_close(fd) < 0) err = -1;
+  return err;
+}
+
+/**
+ * Builds the image: files of several sizes, one of them large, and one in a
+ * subdirectory.  The -i dump stops short of the last inode, which is the
+ * first one handed out, so an empty /last takes it; only -p sees that one.
+ */
+static int BuildImage(int *inumbers) {
+  int fd;
+  struct unixfilesystem *fs = OpenImage(&fd);
+  if (fs == NULL) return -1;
+  int last = file_create(fs, ROOT_INUMBER, "last", 0644);
+  inumbers[0] = testdisk_makefile(fs, ROOT_INUMBER, "a", 300000);
+  inumbers[1] = testdisk_makefile(fs, ROOT_INUMBER, "b", 5000);
+  inumbers[2] = testdisk_makefile(fs, ROOT_INUMBER, "c", 100);
+  int d = file_create(fs, ROOT_INUMBER, "d", IFDIR | 0755);
+  inumbers[3] = d < 0 ? -1 : testdisk_makefile(fs, d, "e", 700);
+  int numInodes = fs->superblock.s_isize * 16;
+  int err = CloseImage(fs, fd);
+  if (last != numInodes) err = -1;
+  for (int i = 0; i < 4; i++) {
+    if (inumbers[i] < 0) err = -1;
+  }
+  return err;
+}
+
+/**
+ * Changes only the mtime of inode inumber.
+ */
+static int TouchInode(int inumber) {
+  int fd;
+  struct unixfilesystem *fs = OpenImage(&fd);
+  if (fs == NULL) return -1;
+  struct inode in;
+  int err = inode_iget(fs, inumber, &in);
+  in.i_mtime[1]++;
+  if (err == 0) err = inode_iput(fs, inumber, &in);
+  if (CloseImage(fs, fd) < 0) err = -1;
+  return err;
+}
+
+/**
+ * Shrinks file inumber to size bytes, keeping its mtime and, since it stays
+ * within its first block, its block map.
+ */
+static int ShrinkInode(int inumber, int size) {
+  int fd;
+  struct unixfilesystem *fs = OpenImage(&fd);
+  if (fs == NULL) return -1;
+  struct inode in;
+  int err = inode_iget(fs, inumber, &in);
+  uint16_t mtime[2];
+  memcpy(mtime, in.i_mtime, sizeof(mtime));
+  if (err == 0) err = file_truncate(fs, inumber, size);
+  if (err == 0) err = inode_iget(fs, inumber, &in);
+  memcpy(in.i_mtime, mtime, sizeof(mtime));
+  if (err == 0) err = inode_iput(fs, inumber, &in);
+  if (CloseImage(fs, fd) < 0) err = -1;
+  return err;
+}
+
+/**
+ * Moves the first block of file inumber to a newly allocated block holding
+ * different data, without touching its mtime or size: only the block map
+ * shows the change.
+ */
+static int MoveFirstBlock(int inumber) {
+  int fd;
+  struct unixfilesystem *fs = OpenImage(&fd);
+  if (fs == NULL) return -1;
+  struct inode in;
+  int err = inode_iget(fs, inumber, &in);
+  int block = err < 0 || (in.i_mode & ILARG) ? -1 : alloc_block(fs);
+  char data[DISKIMG_SECTOR_SIZE];
+  memset(data, 'x', sizeof(data));
+  if (block < 0 || diskimg_writesector(fs->dfd, block, data) != DISKIMG_SECTOR_SIZE) {
+    err = -1;
+  } else {
+    int old = in.i_addr[0];
+    in.i_addr[0] = block;
+    err = inode_iput(fs, inumber, &in);
+    if (err == 0) alloc_freeblock(fs, old);
+  }
+  if (CloseImage(fs, fd) < 0) err = -1;
+  return err;
+}
+
+static void RunTests(const int *inumbers) {
+  // nothing to reuse at first, then everything
+  struct run first = CheckRun("sha1", 0, NUM_ALLOCATED);
+  struct run second = CheckRun("sha1", NUM_ALLOCATED, 0);
+  if (first.ok && second.ok) {
+    CHECK(strcmp(first.out, second.out) == 0);
+    // only the inodes and the indirect blocks of /a are read the second time
+    CHECK(second.misses < first.misses);
+  }
+  free(first.out);
+  free(second.out);
+
+  // the path dump goes through the same manifest, and only has /last to add
+  for (int i = 0; i < 2; i++) {
+    struct run plain = RunAccess("-p", "sha1", 0);
+    struct run paths = RunAccess("-p", "sha1", 1);
+    if (CHECK(plain.ok && paths.ok)) {
+      CHECK(paths.reused == (unsigned long long) (i == 0 ? NUM_ALLOCATED : NUM_ALLOCATED + 1));
+      CHECK(paths.recomputed == (unsigned long long) (i == 0 ? 1 : 0));
+      CHECK(strcmp(paths.out, plain.out) == 0);
+    }
+    free(plain.out);
+    free(paths.out);
+  }
+
+  // a changed mtime, size or block map each force their inode to be rehashed
+  CHECK(TouchInode(inumbers[1]) == 0);
+  free(CheckRun("sha1", NUM_ALLOCATED - 1, 1).out);
+  free(CheckRun("sha1", NUM_ALLOCATED, 0).out);
+  CHECK(ShrinkInode(inumbers[2], 50) == 0);
+  free(CheckRun("sha1", NUM_ALLOCATED - 1, 1).out);
+  CHECK(MoveFirstBlock(inumbers[3]) == 0);
+  free(CheckRun("sha1", NUM_ALLOCATED - 1, 1).out);
+  free(CheckRun("sha1", NUM_ALLOCATED, 0).out);
+
+  // checksums made by one engine are no use to another, in either direction
+  free(CheckRun("xxh64", 0, NUM_ALLOCATED).out);
+  free(CheckRun("xxh64", NUM_ALLOCATED, 0).out);
+  free(CheckRun("sha1", 0, NUM_ALLOCATED).out);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) diskimageaccess = argv[1];
+  int inumbers[4];
+  if (!CHECK(testdisk_create(imagepath, NUM_SECTORS, NUM_INODE_SECTORS) == 0)) exit(EXIT_FAILURE);
+  const char *tmpdir = getenv("TMPDIR");
+  snprintf(dirpath, sizeof(dirpath), "%s/manifestXXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+  if (CHECK(mkdtemp(dirpath) != NULL)) {
+    snprintf(manifestpath, sizeof(manifestpath), "%s/manifest", dirpath);
+    if (CHECK(BuildImage(inumbers) == 0)) RunTests(inumbers);
+    unlink(manifestpath);
+    rmdir(dirpath);
+  }
+  unlink(imagepath);
+  printf("manifest: %s\n", testdisk_failures == 0 ? "ok" : "FAILED");
+  exit(testdisk_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -18,8 +18,21 @@ int pathname_lookup(struct unixfilesystem *fs, const char *pathname) {
   char *for_free = string;
   while( (found = strsep(&string,"/")) != NULL && found[0] != '\0')
   {
-    if(directory_findname(fs, found, inumber, &dirEnt) < 0) return -1;
-    else inumber = dirEnt.d_inumber;
+    // names a directory doesn't have are cached too (as -1), deep walks keep
+    // asking about the same names; errors aren't, the next lookup may get through
+    int next_inumber;
+    if(fs->dcache == NULL || !dcache_lookup(fs->dcache, inumber, found, &next_inumber))
+    {
+      int i_found = directory_findname(fs, found, inumber, &dirEnt);
+      next_inumber = i_found < 0 ? -1 : dirEnt.d_inumber;
+      if(fs->dcache != NULL && i_found != -2) dcache_insert(fs->dcache, inumber, found, next_inumber);
+    }
+    if(next_inumber < 0)
+    {
+      free(for_free);
+      return -1;
+    }
+    inumber = next_inumber;
   }
   free(for_free);
 
@@ -0,0 +1,88 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "readahead.h"
+
+struct readaheadentry {
+  int inumber;     // 0 if the slot is empty
+  int nextBlock;   // block a sequential reader asks for next
+  int window;      // blocks to keep fetched ahead, 0 until the reads look sequential
+  int maxWindow;   // how far the window may grow
+  int aheadEnd;    // first block not fetched ahead yet
+};
+
+struct readahead {
+  unsigned int mask;   // number of slots - 1
+  struct readaheadentry *entries;
+  pthread_mutex_t lock;
+};
+
+struct readahead *readahead_create(int numEntries) {
+  unsigned int size = 1;
+  while (size < (unsigned int) numEntries) size <<= 1;
+
+  struct readahead *ra = malloc(sizeof(struct readahead));
+  if (ra == NULL) return NULL;
+  ra->entries = calloc(size, sizeof(struct readaheadentry));
+  if (ra->entries == NULL) {
+    free(ra);
+    return NULL;
+  }
+  ra->mask = size - 1;
+  pthread_mutex_init(&ra->lock, NULL);
+  return ra;
+}
+
+void readahead_free(struct readahead *ra) {
+  if (ra == NULL) return;
+  pthread_mutex_destroy(&ra->lock);
+  free(ra->entries);
+  free(ra);
+}
+
+static struct readaheadentry *readahead_entry(struct readahead *ra, int inumber) {
+  return &ra->entries[((unsigned int) inumber * 2654435761u) & ra->mask];
+}
+
+int readahead_advance(struct readahead *ra, int inumber, int blockNum, int numFileBlocks, int *first) {
+  pthread_mutex_lock(&ra->lock);
+  struct readaheadentry *e = readahead_entry(ra, inumber);
+  if (e->inumber != inumber || blockNum != e->nextBlock) {
+    // another file, or a jump within this one: start over
+    e->inumber = inumber;
+    e->window = 0;
+    e->maxWindow = READAHEAD_MAX_WINDOW;
+    e->aheadEnd = 0;
+  } else if (e->window == 0) {
+    e->window = READAHEAD_MIN_WINDOW;
+  } else {
+    e->window = 2 * e->window < e->maxWindow ? 2 * e->window : e->maxWindow;
+  }
+  e->nextBlock = blockNum + 1;
+
+  int count = 0;
+  if (e->window > 0 && e->aheadEnd - blockNum < e->window / 2) {
+    int start = e->aheadEnd > blockNum ? e->aheadEnd : blockNum;
+    int end = blockNum + e->window < numFileBlocks ? blockNum + e->window : numFileBlocks;
+    if (start < end) {
+      *first = start;
+      count = end - start;
+      e->aheadEnd = end;
+    }
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return count;
+}
+
+void readahead_shortfall(struct readahead *ra, int inumber, int aheadEnd) {
+  pthread_mutex_lock(&ra->lock);
+  struct readaheadentry *e = readahead_entry(ra, inumber);
+  if (e->inumber == inumber && aheadEnd < e->aheadEnd) {
+    e->aheadEnd = aheadEnd;
+    // from now on, only ask for as much as is already fetched ahead
+    int ahead = aheadEnd - (e->nextBlock - 1);
+    e->maxWindow = ahead > READAHEAD_MIN_WINDOW ? ahead : READAHEAD_MIN_WINDOW;
+    e->window = e->maxWindow;
+  }
+  pthread_mutex_unlock(&ra->lock);
+}
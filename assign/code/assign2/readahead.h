@@ -0,0 +1,49 @@
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+/**
+ * Read-ahead for file_getblock.  For each file being read, the tracker
+ * remembers which block it expects next.  Reads that keep arriving in order
+ * open a read-ahead window, which starts at READAHEAD_MIN_WINDOW blocks and
+ * doubles with every further sequential read up to READAHEAD_MAX_WINDOW;
+ * a read anywhere else closes it again.  The window is refilled once less
+ * than half of it is left ahead of the reader, so a file read front to back
+ * goes to the disk in a few large reads instead of one per block.
+ *
+ * Files are tracked in a small direct-mapped table keyed on the inumber, so
+ * a handful of files can be read in parallel without disturbing each other.
+ * All calls are safe from several threads.
+ */
+
+#define READAHEAD_DEFAULT_ENTRIES 64
+#define READAHEAD_MIN_WINDOW 4
+#define READAHEAD_MAX_WINDOW 64
+
+struct readahead;
+
+/**
+ * Creates a tracker with room for numEntries files (rounded up to a power of
+ * two).  Returns NULL on error.
+ */
+struct readahead *readahead_create(int numEntries);
+
+/**
+ * Releases the tracker.
+ */
+void readahead_free(struct readahead *ra);
+
+/**
+ * Records that block blockNum of file inumber, which has numFileBlocks blocks,
+ * is about to be read.  Returns how many blocks should be fetched ahead,
+ * starting at block *first (which may be blockNum itself), or 0 for none.
+ */
+int readahead_advance(struct readahead *ra, int inumber, int blockNum, int numFileBlocks, int *first);
+
+/**
+ * Records that read-ahead for file inumber only got as far as block aheadEnd,
+ * because the cache wouldn't take any more, and keeps the window from growing
+ * past what it did take.
+ */
+void readahead_shortfall(struct readahead *ra, int inumber, int aheadEnd);
+
+#endif // _READAHEAD_H_
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testdisk.h"
+#include "diskimg.h"
+#include "inode.h"
+#include "file.h"
+#include "filewrite.h"
+
+#define NOF_FREE_SLOTS ((int) (sizeof(((struct filsys *) 0)->s_free) / sizeof(uint16_t)))    // 100
+#define NOF_INODES_PER_SECTOR ((int) (DISKIMG_SECTOR_SIZE / sizeof(struct inode)))         // 16
+#define PATTERN_PERIOD 251
+#define WRITE_CHUNK (64 * 1024)
+
+int testdisk_failures = 0;
+
+int testdisk_check(int ok, const char *what, const char *file, int line) {
+  if (!ok) {
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    testdisk_failures++;
+  }
+  return ok;
+}
+
+int testdisk_create(char *path, int numSectors, int numInodeSectors) {
+  int firstData = INODE_START_SECTOR + numInodeSectors;
+  if (numInodeSectors < 1 || numSectors <= firstData + 1 || numSectors > UINT16_MAX) return -1;
+  const char *dir = getenv("TMPDIR");
+  snprintf(path, TESTDISK_PATHSIZE, "%s/v6testXXXXXX", dir != NULL ? dir : "/tmp");
+  int fd = mkstemp(path);
+  if (fd < 0) return -1;
+  char *image = calloc(numSectors, DISKIMG_SECTOR_SIZE);
+  if (image == NULL) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  uint16_t *bootblock = (uint16_t *) image;
+  bootblock[0] = BOOTBLOCK_MAGIC_NUM;
+  struct filsys *sb = (struct filsys *) (image + SUPERBLOCK_SECTOR * DISKIMG_SECTOR_SIZE);
+  sb->s_isize = numInodeSectors;
+  sb->s_fsize = numSectors;
+
+  struct inode *root = (struct inode *) (image + INODE_START_SECTOR * DISKIMG_SECTOR_SIZE) + (ROOT_INUMBER - 1);
+  root->i_mode = IALLOC | IFDIR | 0755;
+  root->i_nlink = 2;
+  inode_setsize(root, 2 * sizeof(struct direntv6));
+  root->i_addr[0] = firstData;
+  struct direntv6 *dots = (struct direntv6 *) (image + firstData * DISKIMG_SECTOR_SIZE);
+  dots[0].d_inumber = ROOT_INUMBER;
+  strcpy(dots[0].d_name, ".");
+  dots[1].d_inumber = ROOT_INUMBER;
+  strcpy(dots[1].d_name, "..");
+
+  // free the blocks from the top down, the way alloc_freeblock would, so
+  // the lowest end up at the top of the list
+  sb->s_nfree = 1;
+  sb->s_free[0] = 0;
+  for (int b = numSectors - 1; b > firstData; b--) {
+    if (sb->s_nfree == NOF_FREE_SLOTS) {
+      uint16_t *list = (uint16_t *) (image + b * DISKIMG_SECTOR_SIZE);
+      list[0] = sb->s_nfree;
+      memcpy(list + 1, sb->s_free, sizeof(sb->s_free));
+      sb->s_nfree = 0;
+    }
+    sb->s_free[sb->s_nfree++] = b;
+  }
+
+  size_t size = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+  int err = write(fd, image, size) == (ssize_t) size ? 0 : -1;
+  free(image);
+  if (close(fd) < 0) err = -1;
+  if (err < 0) unlink(path);
+  return err;
+}
+
+int testdisk_countfreeblocks(struct unixfilesystem *fs) {
+  uint16_t list[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+  list[0] = fs->superblock.s_nfree;
+  memcpy(list + 1, fs->superblock.s_free, sizeof(fs->superblock.s_free));
+  int count = 0;
+  while (1) {
+    // list[1] links to the block holding the next list, or is 0 at the end
+    int n = list[0];
+    if (n > NOF_FREE_SLOTS || count > fs->superblock.s_fsize) return -1;
+    if (n == 0) return count;
+    count += n - 1;
+    if (list[1] == 0) return count;
+    count++;
+    if (diskimg_readsector(fs->dfd, list[1], list) != DISKIMG_SECTOR_SIZE) return -1;
+  }
+}
+
+int testdisk_countfreeinodes(struct unixfilesystem *fs) {
+  int numInodes = fs->superblock.s_isize * NOF_INODES_PER_SECTOR;
+  int count = 0;
+  for (int inumber = 1; inumber <= numInodes; inumber++) {
+    struct inode in;
+    if (inode_iget(fs, inumber, &in) < 0) return -1;
+    if ((in.i_mode & IALLOC) == 0) count++;
+  }
+  return count;
+}
+
+int testdisk_writepattern(struct unixfilesystem *fs, int inumber, int offset, int len) {
+  char *buf = malloc(WRITE_CHUNK);
+  if (buf == NULL) return -1;
+  int err = 0;
+  for (int done = 0; done < len && err == 0; ) {
+    int n = len - done < WRITE_CHUNK ? len - done : WRITE_CHUNK;
+    for (int i = 0; i < n; i++) buf[i] = (offset + done + i) % PATTERN_PERIOD;
+    if (file_write(fs, inumber, offset + done, buf, n) != n) err = -1;
+    done += n;
+  }
+  free(buf);
+  return err;
+}
+
+int testdisk_checkcontents(struct unixfilesystem *fs, int inumber, int offset, int len, int zero) {
+  char block[DISKIMG_SECTOR_SIZE];
+  for (int pos = offset; pos < offset + len; ) {
+    int nbytes = file_getblock(fs, inumber, pos / DISKIMG_SECTOR_SIZE, block);
+    int within = pos % DISKIMG_SECTOR_SIZE;
+    int n = DISKIMG_SECTOR_SIZE - within < offset + len - pos ? DISKIMG_SECTOR_SIZE - within : offset + len - pos;
+    if (nbytes < within + n) return -1;
+    for (int i = 0; i < n; i++) {
+      char expected = zero ? 0 : (pos + i) % PATTERN_PERIOD;
+      if (block[within + i] != expected) return -1;
+    }
+    pos += n;
+  }
+  return 0;
+}
+
+int testdisk_makefile(struct unixfilesystem *fs, int dirinumber, const char *name, int len) {
+  int inumber = file_create(fs, dirinumber, name, 0644);
+  if (inumber < 0 || testdisk_writepattern(fs, inumber, 0, len) < 0) return -1;
+  return inumber;
+}
+
+int testdisk_filesize(struct unixfilesystem *fs, int inumber) {
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0) return -1;
+  return inode_getsize(&in);
+}
@@ -0,0 +1,72 @@
+#ifndef _TESTDISK_H_
+#define _TESTDISK_H_
+
+#include "unixfilesystem.h"
+
+/**
+ * Helpers shared by the test programs that make check runs.  The tests build
+ * the images they work on from scratch, in temporary files of their own, so
+ * they neither depend on images outside the tree nor get in each other's way,
+ * and check what the library does against numbers worked out independently.
+ */
+
+#define TESTDISK_PATHSIZE 256
+
+/**
+ * Creates an empty V6 filesystem in a new temporary file (see mkstemp):
+ * numSectors sectors in all, numInodeSectors of them holding inodes (16 per
+ * sector), and a root directory holding only "." and "..", in the first data
+ * block.  Every other block is on the free list, ordered so the lowest
+ * numbered are handed out first.  The file's name is written into path, which
+ * must have room for TESTDISK_PATHSIZE bytes.  Returns 0 on success, -1 on
+ * error.
+ */
+int testdisk_create(char *path, int numSectors, int numInodeSectors);
+
+/**
+ * Counts the blocks on the free list by walking its whole chain.  Returns -1
+ * if the chain is damaged.
+ */
+int testdisk_countfreeblocks(struct unixfilesystem *fs);
+
+/**
+ * Counts the inodes that aren't allocated.
+ */
+int testdisk_countfreeinodes(struct unixfilesystem *fs);
+
+/**
+ * The tests fill files with a fixed pattern, whose byte at file offset o is
+ * o % 251, so what a byte should be depends only on where it is.
+ * testdisk_writepattern writes the pattern over bytes [offset, offset + len)
+ * of file inumber, and returns 0 on success, -1 on error.
+ */
+int testdisk_writepattern(struct unixfilesystem *fs, int inumber, int offset, int len);
+
+/**
+ * Checks bytes [offset, offset + len) of file inumber, which must hold the
+ * pattern, or zeros if zero is set.  Returns 0 if they do, -1 otherwise.
+ */
+int testdisk_checkcontents(struct unixfilesystem *fs, int inumber, int offset, int len, int zero);
+
+/**
+ * Creates a file called name in directory dirinumber holding the first len
+ * bytes of the pattern.  Returns its inumber, or -1 on error.
+ */
+int testdisk_makefile(struct unixfilesystem *fs, int dirinumber, const char *name, int len);
+
+/**
+ * Returns the size of file inumber, or -1 on error.
+ */
+int testdisk_filesize(struct unixfilesystem *fs, int inumber);
+
+/**
+ * TESTDISK_CHECK(cond) reports cond, with where it is, if it doesn't hold,
+ * and counts it in testdisk_failures.  Evaluates to cond.
+ */
+#define TESTDISK_CHECK(cond) testdisk_check((cond), #cond, __FILE__, __LINE__)
+
+extern int testdisk_failures;
+
+int testdisk_check(int ok, const char *what, const char *file, int line);
+
+#endif // _TESTDISK_H_
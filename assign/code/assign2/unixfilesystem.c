@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "unixfilesystem.h"
 #include "diskimg.h" 
+#include "inode.h"
 
 /**
  * Allocates and initializes a struct unixfilesystem given a filedescriptor to 
@@ -41,5 +43,41 @@ struct unixfilesystem *unixfilesystem_init(int dfd) {
     return NULL;
   }
 
+  pthread_mutex_init(&fs->superblockLock, NULL);
+
+  // running without the inode table, dentry cache, directory indexes or
+  // read-ahead only costs speed, so a failure here isn't fatal
+  fs->inodetable = inode_createtable(fs->superblock.s_isize);
+  fs->dcache = dcache_create(DCACHE_DEFAULT_ENTRIES);
+  fs->dirindex = dirindex_create();
+  fs->readahead = readahead_create(READAHEAD_DEFAULT_ENTRIES);
   return fs;
 }
+
+int unixfilesystem_sync(struct unixfilesystem *fs) {
+  pthread_mutex_lock(&fs->superblockLock);
+  if (fs->superblock.s_fmod) {
+    // like V6's update(): the copy on disk has s_fmod clear and the time of the write
+    time_t now = time(NULL);
+    fs->superblock.s_fmod = 0;
+    fs->superblock.s_time[0] = (now >> 16) & 0xffff;
+    fs->superblock.s_time[1] = now & 0xffff;
+    if (diskimg_writesector_ordered(fs->dfd, SUPERBLOCK_SECTOR, &fs->superblock,
+                                    DISKIMG_ORDER_SUPERBLOCK) != DISKIMG_SECTOR_SIZE) {
+      fs->superblock.s_fmod = 1;
+      pthread_mutex_unlock(&fs->superblockLock);
+      return -1;
+    }
+  }
+  pthread_mutex_unlock(&fs->superblockLock);
+  return diskimg_flush(fs->dfd);
+}
+
+void unixfilesystem_free(struct unixfilesystem *fs) {
+  inode_freetable(fs->inodetable);
+  dcache_free(fs->dcache);
+  dirindex_free(fs->dirindex);
+  readahead_free(fs->readahead);
+  pthread_mutex_destroy(&fs->superblockLock);
+  free(fs);
+}
@@ -5,9 +5,14 @@
  * Include the definitions taken from the Unix sources. 
  */
 
+#include <pthread.h>
+
 #include "filsys.h"     // Superblock definition
 #include "ino.h"        // Inode definition
 #include "direntv6.h"   // Directory entry
+#include "dcache.h"     // Directory entry cache
+#include "dirindex.h"   // Hash indexes of large directories
+#include "readahead.h"  // Sequential read detection
 
 /**
  * The layout of the Unix disk looked as follows:
@@ -25,11 +30,31 @@
 #define ROOT_INUMBER        1
 #define BOOTBLOCK_MAGIC_NUM 0407
 
+struct inodetable;
+
 struct unixfilesystem {
   int dfd; // Handle from the diskimg module to read the diskimg.
   struct filsys superblock;  // The superblock read from the diskimage.
+  pthread_mutex_t superblockLock; // Guards the superblock's free lists and s_fmod (see alloc.h).
+  struct inodetable *inodetable; // Inode sectors inode_iget has decoded (NULL: read them every time).
+  struct dcache *dcache;         // Name lookups pathname_lookup has already done (NULL: no caching).
+  struct dirindex *dirindex;     // Indexes of large directories directory_findname built (NULL: always scan).
+  struct readahead *readahead;   // Files file_getblock is reading in order (NULL: no read-ahead).
 };
 
 struct unixfilesystem *unixfilesystem_init(int fd);
 
+/**
+ * Releases a struct unixfilesystem returned by unixfilesystem_init, along with
+ * the caches hanging off it.  The disk image itself is left open.
+ */
+void unixfilesystem_free(struct unixfilesystem *fs);
+
+/**
+ * Writes the superblock back if it was modified, then flushes all the
+ * filesystem's dirty sectors to the disk image (see diskimg_flush).
+ * Returns 0 on success, -1 on error.
+ */
+int unixfilesystem_sync(struct unixfilesystem *fs);
+
 #endif // _UNIXFILESYSTEM_H_
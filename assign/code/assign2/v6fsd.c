@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+#include "pathname.h"
+#include "chksumfile.h"
+
+/**
+ * v6fsd keeps one disk image open and answers requests about it over a Unix
+ * domain socket, so repeated inspections hit warm sector, inode and dentry
+ * caches instead of starting from a cold image each time.
+ *
+ * A client sends one request per line and gets one reply per request:
+ *   stat <path>                  ok <inumber> <mode> <size>
+ *   ls <path>                    ok <count>, then count lines "<inumber> <name>"
+ *   read <offset> <length> <path>  ok <count>, then count bytes of the file
+ *   extents <path>               ok <count>, then count lines "<block> <sector> <length>"
+ *   chksum <path>                ok <checksum>
+ *   stats                        ok <sector hits> <misses> <evictions> <dentry hits> <negative hits> <misses>
+ *   quit                         closes the connection
+ * with the mode in hex and the checksum as diskimageaccess prints it.  A path
+ * runs to the end of the line.  A request that fails gets "err <reason>".
+ * A line that doesn't fit in MAX_REQUEST bytes gets "err request too long"
+ * and the connection is closed.
+ *
+ * Each of the worker threads serves one connection at a time; connections
+ * beyond that wait in the listen queue.
+ */
+#define DEFAULT_WORKERS 4
+#define MAX_READ (1 << 20)   // most bytes one read request returns
+#define MAX_REQUEST 4096     // room for one request line and its terminator
+#define MIN_ACCEPT_BACKOFF_US 10000
+#define MAX_ACCEPT_BACKOFF_US 1000000
+
+struct unixfilesystem *fs;
+int listenfd;
+
+static void *ServeConnections(void *arg);
+static void ServeClient(int conn);
+static int ReadRequest(FILE *in, char *line);
+static int HandleRequest(char *line, FILE *out);
+static void DoStat(const char *path, FILE *out);
+static void DoList(const char *path, FILE *out);
+static void DoRead(char *args, FILE *out);
+static void DoExtents(const char *path, FILE *out);
+static void DoChksum(const char *path, FILE *out);
+static void DoStats(FILE *out);
+static void PrintUsageAndExit(char *progname);
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int mmapFlag = 0;
+  int numWorkers = DEFAULT_WORKERS;
+  while ((opt = getopt(argc, argv, "a:c:mt:")) != -1) {
+    switch (opt) {
+    case 'a':
+      if (chksumfile_setengine(optarg) < 0) {
+        fprintf(stderr, "Unknown checksum engine %s\n", optarg);
+        PrintUsageAndExit(argv[0]);
+      }
+      break;
+    case 'c':
+      if (diskimg_setcachesize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Can't allocate a cache of %s sectors\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'm':
+      mmapFlag = 1;
+      break;
+    case 't':
+      numWorkers = atoi(optarg);
+      if (numWorkers < 1) PrintUsageAndExit(argv[0]);
+      break;
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+
+  if (optind != argc-2) {
+    PrintUsageAndExit(argv[0]);
+  }
+  char *socketpath = argv[optind];
+  char *diskpath = argv[optind+1];
+
+  int fd = diskimg_open(diskpath, DISKIMG_READONLY | (mmapFlag ? DISKIMG_MMAP : 0));
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+  fs = unixfilesystem_init(fd);
+  if (!fs) {
+    fprintf(stderr, "Failed to initialize unix filesystem\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", socketpath);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, socketpath);
+  listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenfd < 0 || bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(listenfd, 128) < 0) {
+    perror(socketpath);
+    exit(EXIT_FAILURE);
+  }
+
+  // a client hanging up mid-reply shouldn't kill the daemon, and SIGINT and
+  // SIGTERM are left for this thread to sigwait on
+  signal(SIGPIPE, SIG_IGN);
+  sigset_t stopSignals;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+
+  int started = 0;
+  for (int i = 0; i < numWorkers; i++) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, ServeConnections, NULL) == 0) {
+      pthread_detach(worker);
+      started++;
+    }
+  }
+  if (started == 0) {
+    fprintf(stderr, "Can't start any worker threads\n");
+    unlink(socketpath);
+    exit(EXIT_FAILURE);
+  }
+
+  int sig;
+  sigwait(&stopSignals, &sig);
+
+  // the workers may be midway through requests, so the image is left open
+  // and the process simply ends once the socket is gone
+  unlink(socketpath);
+  exit(EXIT_SUCCESS);
+  return 0;
+}
+
+static void *ServeConnections(void *arg) {
+  useconds_t backoff = 0;
+  while (1) {
+    int conn = accept(listenfd, NULL, NULL);
+    if (conn < 0) {
+      int err = errno;
+      if (err == EINTR || err == ECONNABORTED) continue;
+      // out of descriptors (EMFILE, ENFILE) or memory, most likely: trying
+      // again at once would just spin, so wait for connections to close,
+      // longer each time it keeps failing
+      backoff = backoff == 0 ? MIN_ACCEPT_BACKOFF_US : backoff * 2;
+      if (backoff > MAX_ACCEPT_BACKOFF_US) backoff = MAX_ACCEPT_BACKOFF_US;
+      fprintf(stderr, "v6fsd: accept failed: %s; retrying in %d ms\n", strerror(err), (int) (backoff / 1000));
+      usleep(backoff);
+      continue;
+    }
+    backoff = 0;
+    ServeClient(conn);
+  }
+  return NULL;
+}
+
+/**
+ * Answers requests on conn until the client hangs up or says quit.  conn is
+ * closed on return.
+ */
+static void ServeClient(int conn) {
+  int outfd = dup(conn);
+  FILE *in = fdopen(conn, "r");
+  FILE *out = outfd < 0 ? NULL : fdopen(outfd, "w");
+  if (in == NULL || out == NULL) {
+    if (in != NULL) fclose(in);
+    else close(conn);
+    if (out != NULL) fclose(out);
+    else if (outfd >= 0) close(outfd);
+    return;
+  }
+
+  char line[MAX_REQUEST];
+  int len;
+  while ((len = ReadRequest(in, line)) >= 0) {
+    if (HandleRequest(line, out) < 0) break;
+    if (fflush(out) != 0) break;
+  }
+  if (len == -2) fprintf(out, "err request too long\n");
+  fclose(in);
+  fclose(out);
+}
+
+/**
+ * Reads the next request line from in into line, which has room for
+ * MAX_REQUEST bytes, and strips its line ending.  Returns its length, -1 at
+ * the end of the input, or -2 if the line doesn't fit, in which case the
+ * rest of it is left unread.
+ */
+static int ReadRequest(FILE *in, char *line) {
+  int len = 0;
+  int c;
+  while ((c = getc(in)) != EOF && c != '\n') {
+    if (len == MAX_REQUEST - 1) return -2;
+    line[len++] = c;
+  }
+  if (c == EOF && len == 0) return -1;
+  if (len > 0 && line[len-1] == '\r') len--;
+  line[len] = '\0';
+  return len;
+}
+
+/**
+ * Writes the reply to one request line to out.  Returns -1 if the client
+ * asked to close the connection, 0 otherwise.
+ */
+static int HandleRequest(char *line, FILE *out) {
+  char *args = strchr(line, ' ');
+  if (args != NULL) *args++ = '\0';
+  else args = line + strlen(line);
+
+  if (strcmp(line, "stat") == 0) DoStat(args, out);
+  else if (strcmp(line, "ls") == 0) DoList(args, out);
+  else if (strcmp(line, "read") == 0) DoRead(args, out);
+  else if (strcmp(line, "extents") == 0) DoExtents(args, out);
+  else if (strcmp(line, "chksum") == 0) DoChksum(args, out);
+  else if (strcmp(line, "stats") == 0) DoStats(out);
+  else if (strcmp(line, "quit") == 0) return -1;
+  else fprintf(out, "err unknown request %s\n", line);
+  return 0;
+}
+
+/**
+ * Looks path up and fetches its inode.  Returns the inumber, or -1 after
+ * writing the error reply to out.
+ */
+static int LookupInode(const char *path, struct inode *in, FILE *out) {
+  if (path[0] != '/') {
+    fprintf(out, "err path must start with /\n");
+    return -1;
+  }
+  int inumber = pathname_lookup(fs, path);
+  if (inumber < 0) {
+    fprintf(out, "err no such file %s\n", path);
+    return -1;
+  }
+  if (inode_iget(fs, inumber, in) < 0) {
+    fprintf(out, "err can't read inode %d\n", inumber);
+    return -1;
+  }
+  return inumber;
+}
+
+static void DoStat(const char *path, FILE *out) {
+  struct inode in;
+  int inumber = LookupInode(path, &in, out);
+  if (inumber < 0) return;
+  fprintf(out, "ok %d 0x%x %d\n", inumber, in.i_mode, inode_getsize(&in));
+}
+
+static void DoList(const char *path, FILE *out) {
+  struct inode in;
+  int inumber = LookupInode(path, &in, out);
+  if (inumber < 0) return;
+  if ((in.i_mode & IFMT) != IFDIR) {
+    fprintf(out, "err %s isn't a directory\n", path);
+    return;
+  }
+
+  // the entries are gathered first, since the reply starts with their count
+  char *listing = NULL;
+  size_t listingSize = 0;
+  FILE *entries = open_memstream(&listing, &listingSize);
+  if (entries == NULL) {
+    fprintf(out, "err out of memory\n");
+    return;
+  }
+  int count = 0;
+  int numBlocks = (inode_getsize(&in) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  char buf[DISKIMG_SECTOR_SIZE];
+  for (int bno = 0; bno < numBlocks; bno++) {
+    const void *data;
+    int bytes = file_getblock_ptr(fs, inumber, bno, buf, &data);
+    if (bytes < 0) {
+      fclose(entries);
+      free(listing);
+      fprintf(out, "err can't read directory %s\n", path);
+      return;
+    }
+    const struct direntv6 *dir = data;
+    for (int i = 0; i < bytes / (int) sizeof(struct direntv6); i++) {
+      if (dir[i].d_inumber == 0) continue;
+      fprintf(entries, "%d %.*s\n", dir[i].d_inumber, (int) sizeof(dir[i].d_name), dir[i].d_name);
+      count++;
+    }
+  }
+  fclose(entries);
+  fprintf(out, "ok %d\n", count);
+  fwrite(listing, 1, listingSize, out);
+  free(listing);
+}
+
+static void DoRead(char *args, FILE *out) {
+  int offset, length, pathStart = -1;
+  if (sscanf(args, "%d %d %n", &offset, &length, &pathStart) != 2 || pathStart < 0 ||
+      offset < 0 || length < 0) {
+    fprintf(out, "err usage: read <offset> <length> <path>\n");
+    return;
+  }
+  struct inode in;
+  const char *path = args + pathStart;
+  int inumber = LookupInode(path, &in, out);
+  if (inumber < 0) return;
+
+  int size = inode_getsize(&in);
+  if (length > MAX_READ) length = MAX_READ;
+  if (offset > size) offset = size;
+  if (length > size - offset) length = size - offset;
+
+  // the reply announces its length up front, so a block that can't be read
+  // has to be caught before anything is sent.  The sectors the range spans
+  // are read with one call per extent.
+  struct inode_extent *extents;
+  int numExtents = inode_getextents(fs, &in, &extents);
+  if (numExtents < 0) {
+    fprintf(out, "err can't read the block map of %s\n", path);
+    return;
+  }
+  int firstBlock = offset / DISKIMG_SECTOR_SIZE;
+  int endBlock = (offset + length + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  char *sectors = malloc(endBlock > firstBlock ? (size_t) (endBlock - firstBlock) * DISKIMG_SECTOR_SIZE : 1);
+  if (sectors == NULL) {
+    free(extents);
+    fprintf(out, "err out of memory\n");
+    return;
+  }
+  for (int i = 0; i < numExtents; i++) {
+    struct inode_extent *e = &extents[i];
+    int first = e->blockNum > firstBlock ? e->blockNum : firstBlock;
+    int end = e->blockNum + e->numBlocks < endBlock ? e->blockNum + e->numBlocks : endBlock;
+    if (first >= end) continue;
+    int count = end - first;
+    char *dest = sectors + (size_t) (first - firstBlock) * DISKIMG_SECTOR_SIZE;
+    if (diskimg_readsectors(fs->dfd, e->sectorNum + first - e->blockNum, count, dest) != count * DISKIMG_SECTOR_SIZE) {
+      free(extents);
+      free(sectors);
+      fprintf(out, "err can't read block %d of %s\n", first, path);
+      return;
+    }
+  }
+  free(extents);
+  fprintf(out, "ok %d\n", length);
+  fwrite(sectors + offset % DISKIMG_SECTOR_SIZE, 1, length, out);
+  free(sectors);
+}
+
+static void DoExtents(const char *path, FILE *out) {
+  struct inode in;
+  int inumber = LookupInode(path, &in, out);
+  if (inumber < 0) return;
+  struct inode_extent *extents;
+  int numExtents = inode_getextents(fs, &in, &extents);
+  if (numExtents < 0) {
+    fprintf(out, "err can't read the block map of %s\n", path);
+    return;
+  }
+  fprintf(out, "ok %d\n", numExtents);
+  for (int i = 0; i < numExtents; i++) {
+    fprintf(out, "%d %d %d\n", extents[i].blockNum, extents[i].sectorNum, extents[i].numBlocks);
+  }
+  free(extents);
+}
+
+static void DoChksum(const char *path, FILE *out) {
+  struct inode in;
+  int inumber = LookupInode(path, &in, out);
+  if (inumber < 0) return;
+  char chksum[CHKSUMFILE_SIZE];
+  if (chksumfile_byinumber(fs, inumber, chksum) < 0) {
+    fprintf(out, "err can't checksum %s\n", path);
+    return;
+  }
+  char chksumstring[CHKSUMFILE_STRINGSIZE];
+  chksumfile_cvt2string(chksum, chksumstring);
+  fprintf(out, "ok %s\n", chksumstring);
+}
+
+static void DoStats(FILE *out) {
+  struct diskimg_cachestats stats;
+  diskimg_getcachestats(&stats);
+  struct dcache_stats dstats;
+  memset(&dstats, 0, sizeof(dstats));
+  if (fs->dcache != NULL) dcache_getstats(fs->dcache, &dstats);
+  fprintf(out, "ok %llu %llu %llu %llu %llu %llu\n",
+          (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+          (unsigned long long) stats.evictions, (unsigned long long) dstats.hits,
+          (unsigned long long) dstats.negativeHits, (unsigned long long) dstats.misses);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options> socketPath diskimagePath\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-a E   checksum with engine E: sha1 (default), sha256, blake2s or xxh64\n");
+  fprintf(stderr, "-c N   cache up to N disk sectors (default %d, 0 turns the cache off)\n",
+          DISKIMG_DEFAULT_CACHE_SECTORS);
+  fprintf(stderr, "-m     memory-map the disk image instead of reading it sector by sector\n");
+  fprintf(stderr, "-t N   serve up to N clients at once (default %d)\n", DEFAULT_WORKERS);
+  exit(EXIT_FAILURE);
+}
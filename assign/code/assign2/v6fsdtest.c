@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <openssl/evp.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "filewrite.h"
+#include "chksumfile.h"
+#include "testdisk.h"
+
+/**
+ * v6fsdtest starts ./v6fsd on an image it has just built and checks the
+ * replies to each kind of request against what it knows went into the image:
+ * stat, ls, read, extents, chksum and stats, the error replies, and that an
+ * over-long request line is turned away.  The expected extents come from
+ * walking the block map one block at a time, and the expected checksums from
+ * hashing the pattern directly.
+ */
+#define NUM_SECTORS 2000
+#define NUM_INODE_SECTORS 4
+#define MAX_REQUEST 4096        // as in v6fsd.c
+#define CONNECT_ATTEMPTS 100
+#define CONNECT_INTERVAL_US 50000
+#define MAX_EXTENTS 64
+#define PATTERN_PERIOD 251
+
+#define CHECK TESTDISK_CHECK
+
+struct file {
+  const char *path;
+  int inumber;
+  int mode;
+  int size;
+  int gap;                      // bytes of zeros before the pattern starts
+  struct inode_extent extents[MAX_EXTENTS];
+  int numExtents;
+};
+
+static struct file files[] = {
+  { .path = "/a", .size = 300000 },
+  { .path = "/d/small", .size = 1100, .gap = 100 },
+  { .path = "/d/empty", .size = 0 },
+};
+#define NUM_FILES ((int) (sizeof(files) / sizeof(files[0])))
+
+static char ExpectedByte(const struct file *f, int offset) {
+  return offset < f->gap ? 0 : offset % PATTERN_PERIOD;
+}
+
+/**
+ * Works out f's extents from its block map, one block at a time.
+ */
+static int FindExtents(struct unixfilesystem *fs, struct file *f) {
+  struct inode in;
+  if (inode_iget(fs, f->inumber, &in) < 0) return -1;
+  f->mode = in.i_mode;
+  f->numExtents = 0;
+  int numBlocks = (f->size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  for (int b = 0; b < numBlocks; b++) {
+    int sector = inode_indexlookup(fs, &in, b);
+    if (sector <= 0) return -1;
+    struct inode_extent *last = f->numExtents > 0 ? &f->extents[f->numExtents - 1] : NULL;
+    if (last != NULL && last->sectorNum + last->numBlocks == sector) {
+      last->numBlocks++;
+    } else {
+      if (f->numExtents == MAX_EXTENTS) return -1;
+      f->extents[f->numExtents++] = (struct inode_extent) { b, sector, 1 };
+    }
+  }
+  return 0;
+}
+
+/**
+ * Builds the image: a large file, and a directory holding a file that starts
+ * with a gap and an empty one.
+ */
+static int BuildImage(char *path, int *dirinumber) {
+  int fd = diskimg_open(path, DISKIMG_WRITEBACK);
+  struct unixfilesystem *fs = fd < 0 ? NULL : unixfilesystem_init(fd);
+  if (fs == NULL) return -1;
+  int err = 0;
+  files[0].inumber = testdisk_makefile(fs, ROOT_INUMBER, "a", files[0].size);
+  *dirinumber = file_create(fs, ROOT_INUMBER, "d", IFDIR | 0755);
+  files[1].inumber = *dirinumber < 0 ? -1 : file_create(fs, *dirinumber, "small", 0644);
+  if (files[1].inumber < 0 || testdisk_writepattern(fs, files[1].inumber, 100, 1000) < 0) err = -1;
+  files[2].inumber = *dirinumber < 0 ? -1 : file_create(fs, *dirinumber, "empty", 0600);
+  for (int i = 0; i < NUM_FILES && err == 0; i++) {
+    if (files[i].inumber < 0 || FindExtents(fs, &files[i]) < 0) err = -1;
+  }
+  if (unixfilesystem_sync(fs) < 0) err = -1;
+  unixfilesystem_free(fs);
+  if (diskimg_close(fd) < 0) err = -1;
+  return err;
+}
+
+/**
+ * The chksum reply f should get: SHA-1 over its contents.
+ */
+static void ExpectedChksum(const struct file *f, char *chksumstring) {
+  char *contents = malloc(f->size + 1);
+  for (int i = 0; i < f->size; i++) contents[i] = ExpectedByte(f, i);
+  unsigned char chksum[CHKSUMFILE_SIZE];
+  EVP_Digest(contents, f->size, chksum, NULL, EVP_sha1(), NULL);
+  chksumfile_cvt2string(chksum, chksumstring);
+  free(contents);
+}
+
+/**
+ * Sends one request line and reads the first line of the reply into reply,
+ * without its newline.  Returns 0, or -1 if the connection closed first.
+ */
+static int Request(FILE *in, FILE *out, const char *request, char *reply, int replySize) {
+  fprintf(out, "%s\n", request);
+  fflush(out);
+  if (fgets(reply, replySize, in) == NULL) return -1;
+  reply[strcspn(reply, "\n")] = '\0';
+  return 0;
+}
+
+static int StartsWith(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static void CheckStat(FILE *in, FILE *out, const struct file *f) {
+  char request[64], reply[128], expected[128];
+  snprintf(request, sizeof(request), "stat %s", f->path);
+  snprintf(expected, sizeof(expected), "ok %d 0x%x %d", f->inumber, f->mode, f->size);
+  CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, expected) == 0);
+}
+
+static void CheckList(FILE *in, FILE *out, const char *path, const char *const *expectedLines, int count) {
+  char request[64], reply[128], expected[32];
+  snprintf(request, sizeof(request), "ls %s", path);
+  snprintf(expected, sizeof(expected), "ok %d", count);
+  if (!CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, expected) == 0)) return;
+  for (int i = 0; i < count; i++) {
+    CHECK(fgets(reply, sizeof(reply), in) != NULL && strcmp(reply, expectedLines[i]) == 0);
+  }
+}
+
+static void CheckRead(FILE *in, FILE *out, const struct file *f, int offset, int length) {
+  char request[64], reply[128], expected[32];
+  snprintf(request, sizeof(request), "read %d %d %s", offset, length, f->path);
+  int start = offset < f->size ? offset : f->size;
+  int count = length < f->size - start ? length : f->size - start;
+  snprintf(expected, sizeof(expected), "ok %d", count);
+  if (!CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, expected) == 0)) return;
+  char *data = malloc(count + 1);
+  int ok = fread(data, 1, count, in) == (size_t) count;
+  for (int i = 0; i < count && ok; i++) ok = data[i] == ExpectedByte(f, start + i);
+  CHECK(ok);
+  free(data);
+}
+
+static void CheckExtents(FILE *in, FILE *out, const struct file *f) {
+  char request[64], reply[128], expected[64];
+  snprintf(request, sizeof(request), "extents %s", f->path);
+  snprintf(expected, sizeof(expected), "ok %d", f->numExtents);
+  if (!CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, expected) == 0)) return;
+  for (int i = 0; i < f->numExtents; i++) {
+    const struct inode_extent *e = &f->extents[i];
+    snprintf(expected, sizeof(expected), "%d %d %d\n", e->blockNum, e->sectorNum, e->numBlocks);
+    CHECK(fgets(reply, sizeof(reply), in) != NULL && strcmp(reply, expected) == 0);
+  }
+}
+
+static void CheckChksum(FILE *in, FILE *out, const struct file *f) {
+  char request[64], reply[256], expected[CHKSUMFILE_STRINGSIZE + 3];
+  char chksumstring[CHKSUMFILE_STRINGSIZE];
+  ExpectedChksum(f, chksumstring);
+  snprintf(request, sizeof(request), "chksum %s", f->path);
+  snprintf(expected, sizeof(expected), "ok %s", chksumstring);
+  CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, expected) == 0);
+}
+
+/**
+ * Fetches the stats counters: sector hits, misses and evictions, then dentry
+ * hits, negative hits and misses.
+ */
+static int GetStats(FILE *in, FILE *out, unsigned long long *counters) {
+  char reply[256];
+  if (Request(in, out, "stats", reply, sizeof(reply)) < 0) return -1;
+  int n = sscanf(reply, "ok %llu %llu %llu %llu %llu %llu", &counters[0], &counters[1], &counters[2],
+                 &counters[3], &counters[4], &counters[5]);
+  return n == 6 ? 0 : -1;
+}
+
+static void CheckErrors(FILE *in, FILE *out) {
+  char reply[256];
+  CHECK(Request(in, out, "stat /nosuch", reply, sizeof(reply)) == 0 && strcmp(reply, "err no such file /nosuch") == 0);
+  CHECK(Request(in, out, "stat a", reply, sizeof(reply)) == 0 && strcmp(reply, "err path must start with /") == 0);
+  CHECK(Request(in, out, "ls /a", reply, sizeof(reply)) == 0 && strcmp(reply, "err /a isn't a directory") == 0);
+  CHECK(Request(in, out, "read -1 10 /a", reply, sizeof(reply)) == 0 && StartsWith(reply, "err usage"));
+  CHECK(Request(in, out, "frob /a", reply, sizeof(reply)) == 0 && strcmp(reply, "err unknown request frob") == 0);
+
+  // the longest line that fits is still served; the reply repeats the path
+  char request[MAX_REQUEST + 16], longReply[MAX_REQUEST + 64];
+  snprintf(request, sizeof(request), "stat /");
+  memset(request + 6, 'x', MAX_REQUEST - 1 - 6);
+  request[MAX_REQUEST - 1] = '\0';
+  CHECK(Request(in, out, request, longReply, sizeof(longReply)) == 0 && StartsWith(longReply, "err no such file"));
+}
+
+/**
+ * Connects to the daemon, retrying while it starts up.  Returns the socket,
+ * or -1.
+ */
+static int Connect(const char *socketpath) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketpath);
+  for (int attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++) {
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0) return -1;
+    if (connect(conn, (struct sockaddr *) &addr, sizeof(addr)) == 0) return conn;
+    close(conn);
+    usleep(CONNECT_INTERVAL_US);
+  }
+  return -1;
+}
+
+static int OpenStreams(const char *socketpath, FILE **in, FILE **out) {
+  int conn = Connect(socketpath);
+  if (conn < 0) return -1;
+  *in = fdopen(conn, "r");
+  *out = fdopen(dup(conn), "w");
+  return *in != NULL && *out != NULL ? 0 : -1;
+}
+
+static void RunTests(const char *socketpath, int dirinumber) {
+  FILE *in, *out;
+  if (!CHECK(OpenStreams(socketpath, &in, &out) == 0)) return;
+
+  for (int i = 0; i < NUM_FILES; i++) CheckStat(in, out, &files[i]);
+  char rootLines[4][32], dirLines[4][32];
+  snprintf(rootLines[0], sizeof(rootLines[0]), "%d .\n", ROOT_INUMBER);
+  snprintf(rootLines[1], sizeof(rootLines[1]), "%d ..\n", ROOT_INUMBER);
+  snprintf(rootLines[2], sizeof(rootLines[2]), "%d a\n", files[0].inumber);
+  snprintf(rootLines[3], sizeof(rootLines[3]), "%d d\n", dirinumber);
+  snprintf(dirLines[0], sizeof(dirLines[0]), "%d .\n", dirinumber);
+  snprintf(dirLines[1], sizeof(dirLines[1]), "%d ..\n", ROOT_INUMBER);
+  snprintf(dirLines[2], sizeof(dirLines[2]), "%d small\n", files[1].inumber);
+  snprintf(dirLines[3], sizeof(dirLines[3]), "%d empty\n", files[2].inumber);
+  const char *root[] = { rootLines[0], rootLines[1], rootLines[2], rootLines[3] };
+  const char *dir[] = { dirLines[0], dirLines[1], dirLines[2], dirLines[3] };
+  CheckList(in, out, "/", root, 4);
+  CheckList(in, out, "/d", dir, 4);
+
+  CheckRead(in, out, &files[0], 0, files[0].size);
+  CheckRead(in, out, &files[0], 123456, 70000);
+  CheckRead(in, out, &files[0], 299990, 100);
+  CheckRead(in, out, &files[0], 400000, 10);
+  CheckRead(in, out, &files[1], 0, 200);
+  CheckRead(in, out, &files[1], 100, 1000);
+  CheckRead(in, out, &files[2], 0, 10);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    CheckExtents(in, out, &files[i]);
+    CheckChksum(in, out, &files[i]);
+  }
+
+  // everything above went through the caches; asking for a path again has to
+  // be a dentry hit
+  unsigned long long before[6], after[6];
+  if (CHECK(GetStats(in, out, before) == 0)) {
+    CHECK(before[0] + before[1] > 0);
+    CheckStat(in, out, &files[1]);
+    CHECK(GetStats(in, out, after) == 0 && after[3] > before[3] && after[5] == before[5]);
+  }
+
+  CheckErrors(in, out);
+
+  char reply[256];
+  CHECK(Request(in, out, "quit", reply, sizeof(reply)) < 0);
+  fclose(in);
+  fclose(out);
+
+  // a line too long for the daemon to take is answered once, then the
+  // connection is closed
+  if (CHECK(OpenStreams(socketpath, &in, &out) == 0)) {
+    char *request = malloc(2 * MAX_REQUEST);
+    snprintf(request, 2 * MAX_REQUEST, "stat /");
+    memset(request + 6, 'x', 2 * MAX_REQUEST - 7);
+    request[2 * MAX_REQUEST - 1] = '\0';
+    CHECK(Request(in, out, request, reply, sizeof(reply)) == 0 && strcmp(reply, "err request too long") == 0);
+    CHECK(fgets(reply, sizeof(reply), in) == NULL);
+    free(request);
+    fclose(in);
+    fclose(out);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *v6fsd = argc > 1 ? argv[1] : "./v6fsd";
+  signal(SIGPIPE, SIG_IGN);
+
+  char imagepath[TESTDISK_PATHSIZE];
+  int dirinumber;
+  if (!CHECK(testdisk_create(imagepath, NUM_SECTORS, NUM_INODE_SECTORS) == 0)) exit(EXIT_FAILURE);
+  if (!CHECK(BuildImage(imagepath, &dirinumber) == 0)) {
+    unlink(imagepath);
+    exit(EXIT_FAILURE);
+  }
+
+  const char *tmpdir = getenv("TMPDIR");
+  char dirpath[TESTDISK_PATHSIZE], socketpath[TESTDISK_PATHSIZE + 8];
+  snprintf(dirpath, sizeof(dirpath), "%s/v6fsdXXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+  if (!CHECK(mkdtemp(dirpath) != NULL)) {
+    unlink(imagepath);
+    exit(EXIT_FAILURE);
+  }
+  snprintf(socketpath, sizeof(socketpath), "%s/sock", dirpath);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(v6fsd, v6fsd, "-t", "2", socketpath, imagepath, (char *) NULL);
+    perror(v6fsd);
+    _exit(EXIT_FAILURE);
+  }
+  if (CHECK(pid > 0)) {
+    RunTests(socketpath, dirinumber);
+    int status;
+    kill(pid, SIGTERM);
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    CHECK(access(socketpath, F_OK) < 0);
+  }
+  unlink(socketpath);
+  rmdir(dirpath);
+  unlink(imagepath);
+  printf("v6fsd: %s\n", testdisk_failures == 0 ? "ok" : "FAILED");
+  exit(testdisk_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "pathname.h"
+#include "filewrite.h"
+#include "alloc.h"
+#include "testdisk.h"
+
+/**
+ * writetest runs the filewrite calls on fresh images and checks what they
+ * leave behind against numbers worked out by hand: file sizes, the bytes read
+ * back, how many blocks and inodes are free, that freed blocks and inodes are
+ * handed out again, that failures give back what they took, and that it all
+ * survives closing and reopening the image.  It goes through the same steps
+ * with write-back caching (also with a cache small enough to fill up with
+ * dirty sectors), writing straight through, and with the sector cache off.
+ */
+#define NUM_SECTORS 4000
+#define NUM_INODE_SECTORS 8
+#define NUM_INODES (NUM_INODE_SECTORS * 16)
+#define ADDRS_PER_BLOCK 256
+#define ALLOC_THREADS 4
+
+#define CHECK TESTDISK_CHECK
+
+/**
+ * Returns how many blocks a file of size bytes takes, indirect blocks included.
+ */
+static int BlocksForSize(int size) {
+  int data = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  if (data <= 8) return data;
+  int indirect = (data + ADDRS_PER_BLOCK - 1) / ADDRS_PER_BLOCK;
+  return data + indirect + (indirect > 7);
+}
+
+/**
+ * Fills blocks[] with every block file inumber uses, data and indirect, and
+ * returns how many there are (at most maxBlocks), or -1 on error.  Only
+ * handles files without a doubly-indirect block.
+ */
+static int GetFileBlocks(struct unixfilesystem *fs, int inumber, int *blocks, int maxBlocks) {
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0) return -1;
+  int count = 0;
+  if (in.i_mode & ILARG) {
+    for (int k = 0; k < 7 && in.i_addr[k] != 0 && count < maxBlocks; k++) blocks[count++] = in.i_addr[k];
+  }
+  int numBlocks = (inode_getsize(&in) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  for (int b = 0; b < numBlocks && count < maxBlocks; b++) {
+    int sector = inode_indexlookup(fs, &in, b);
+    if (sector <= 0) return -1;
+    blocks[count++] = sector;
+  }
+  return count;
+}
+
+static int Contains(const int *blocks, int numBlocks, int blockNum) {
+  for (int i = 0; i < numBlocks; i++) {
+    if (blocks[i] == blockNum) return 1;
+  }
+  return 0;
+}
+
+struct allocresult {
+  struct unixfilesystem *fs;
+  int inumbers[NUM_INODES];
+  int count;
+};
+
+static void *AllocInodes(void *arg) {
+  struct allocresult *result = arg;
+  int inumber;
+  while ((inumber = alloc_inode(result->fs)) > 0) result->inumbers[result->count++] = inumber;
+  return NULL;
+}
+
+/**
+ * Several threads take inodes until there are none left.  Each inode must go
+ * to exactly one of them, and all of them must go.  They're freed again
+ * afterwards.
+ */
+static void CheckConcurrentAllocation(struct unixfilesystem *fs, int freeInodes) {
+  static struct allocresult results[ALLOC_THREADS];
+  pthread_t threads[ALLOC_THREADS];
+  for (int t = 0; t < ALLOC_THREADS; t++) {
+    results[t].fs = fs;
+    results[t].count = 0;
+    pthread_create(&threads[t], NULL, AllocInodes, &results[t]);
+  }
+  for (int t = 0; t < ALLOC_THREADS; t++) pthread_join(threads[t], NULL);
+
+  int taken[NUM_INODES + 1];
+  memset(taken, 0, sizeof(taken));
+  int total = 0, duplicates = 0;
+  for (int t = 0; t < ALLOC_THREADS; t++) {
+    for (int i = 0; i < results[t].count; i++) {
+      int inumber = results[t].inumbers[i];
+      if (taken[inumber]++) duplicates++;
+      total++;
+    }
+  }
+  CHECK(duplicates == 0);
+  CHECK(total == freeInodes);
+  CHECK(testdisk_countfreeinodes(fs) == 0);
+
+  for (int t = 0; t < ALLOC_THREADS; t++) {
+    for (int i = 0; i < results[t].count; i++) {
+      struct inode in;
+      memset(&in, 0, sizeof(in));
+      inode_iput(fs, results[t].inumbers[i], &in);
+      alloc_freeinode(fs, results[t].inumbers[i]);
+    }
+  }
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+}
+
+/**
+ * Goes through every step on a fresh image opened with the given diskimg_open
+ * flags and a sector cache of cacheSectors sectors.
+ */
+static void RunTests(const char *label, int flags, int cacheSectors) {
+  int failuresBefore = testdisk_failures;
+  char path[TESTDISK_PATHSIZE];
+  if (!CHECK(testdisk_create(path, NUM_SECTORS, NUM_INODE_SECTORS) == 0)) return;
+  CHECK(diskimg_setcachesize(cacheSectors) == 0);
+  int fd = diskimg_open(path, flags);
+  struct unixfilesystem *fs = fd < 0 ? NULL : unixfilesystem_init(fd);
+  if (!CHECK(fs != NULL)) {
+    unlink(path);
+    return;
+  }
+
+  // everything but the boot block, superblock, inodes and root directory is free
+  int freeBlocks = NUM_SECTORS - (INODE_START_SECTOR + NUM_INODE_SECTORS) - 1;
+  int freeInodes = NUM_INODES - 1;
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+
+  // a large file: 586 data blocks behind 3 indirect blocks
+  int a = testdisk_makefile(fs, ROOT_INUMBER, "a", 300000);
+  CHECK(a > 0);
+  CHECK(pathname_lookup(fs, "/a") == a);
+  CHECK(testdisk_filesize(fs, a) == 300000);
+  CHECK(testdisk_checkcontents(fs, a, 0, 300000, 0) == 0);
+  freeBlocks -= 586 + 3;
+  freeInodes--;
+  CHECK(BlocksForSize(300000) == 586 + 3);
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+
+  // a directory holding a file whose first 100 bytes were never written
+  int d = file_create(fs, ROOT_INUMBER, "d", IFDIR | 0755);
+  int small = d < 0 ? -1 : file_create(fs, d, "small", 0644);
+  CHECK(small > 0);
+  CHECK(testdisk_writepattern(fs, small, 100, 1000) == 0);
+  CHECK(pathname_lookup(fs, "/d/small") == small);
+  CHECK(testdisk_filesize(fs, small) == 1100);
+  CHECK(testdisk_checkcontents(fs, small, 0, 100, 1) == 0);
+  CHECK(testdisk_checkcontents(fs, small, 100, 1000, 0) == 0);
+  struct inode in;
+  CHECK(inode_iget(fs, ROOT_INUMBER, &in) == 0 && in.i_nlink == 3);
+  CHECK(inode_iget(fs, d, &in) == 0 && in.i_nlink == 2 && inode_getsize(&in) == 3 * 16);
+  freeBlocks -= 1 + 3;
+  freeInodes -= 2;
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+
+  // calls that fail change nothing
+  CHECK(file_create(fs, ROOT_INUMBER, "a", 0644) < 0);
+  CHECK(file_create(fs, a, "x", 0644) < 0);
+  CHECK(file_unlink(fs, ROOT_INUMBER, "missing") < 0);
+  CHECK(file_unlink(fs, ROOT_INUMBER, "d") < 0);
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+
+  // shrinking gives back the blocks past the new end: 100000 bytes take 196
+  // data blocks behind a single indirect block
+  CHECK(file_truncate(fs, a, 100000) == 0);
+  CHECK(testdisk_filesize(fs, a) == 100000);
+  CHECK(testdisk_checkcontents(fs, a, 0, 100000, 0) == 0);
+  freeBlocks += BlocksForSize(300000) - (196 + 1);
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+
+  // growing zero-fills, and past 8 blocks the file turns large: 10 data
+  // blocks and an indirect block
+  CHECK(file_truncate(fs, small, 5000) == 0);
+  CHECK(testdisk_filesize(fs, small) == 5000);
+  CHECK(testdisk_checkcontents(fs, small, 100, 1000, 0) == 0);
+  CHECK(testdisk_checkcontents(fs, small, 1100, 3900, 1) == 0);
+  CHECK(inode_iget(fs, small, &in) == 0 && (in.i_mode & ILARG));
+  freeBlocks -= (10 + 1) - 3;
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+
+  // unlinking gives back the inode and every block, and they're the next
+  // ones handed out
+  int oldBlocks[BlocksForSize(100000)];
+  CHECK(GetFileBlocks(fs, a, oldBlocks, BlocksForSize(100000)) == BlocksForSize(100000));
+  CHECK(file_unlink(fs, ROOT_INUMBER, "a") == 0);
+  CHECK(pathname_lookup(fs, "/a") < 0);
+  freeBlocks += BlocksForSize(100000);
+  freeInodes++;
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+  int b = testdisk_makefile(fs, ROOT_INUMBER, "b", 100000);
+  CHECK(b == a);
+  int newBlocks[BlocksForSize(100000)];
+  int numNew = GetFileBlocks(fs, b, newBlocks, BlocksForSize(100000));
+  CHECK(numNew == BlocksForSize(100000));
+  int reused = 0;
+  for (int i = 0; i < numNew; i++) reused += Contains(oldBlocks, BlocksForSize(100000), newBlocks[i]);
+  CHECK(reused == numNew);
+  CHECK(testdisk_checkcontents(fs, b, 0, 100000, 0) == 0);
+  freeBlocks -= BlocksForSize(100000);
+  freeInodes--;
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+
+  // a write that runs out of space fails, and gives back what it took
+  int full = file_create(fs, ROOT_INUMBER, "full", 0644);
+  CHECK(full > 0);
+  int tooMuch = (freeBlocks + 10) * DISKIMG_SECTOR_SIZE;
+  char *buf = calloc(tooMuch, 1);
+  CHECK(buf != NULL && file_write(fs, full, 0, buf, tooMuch) < 0);
+  free(buf);
+  CHECK(testdisk_filesize(fs, full) == 0);
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+  CHECK(file_unlink(fs, ROOT_INUMBER, "full") == 0);
+
+  // running out of inodes: the root directory grows by 4 blocks on the way,
+  // and shrinks back as they go
+  int created = 0;
+  char name[16];
+  while (1) {
+    snprintf(name, sizeof(name), "i%d", created);
+    if (file_create(fs, ROOT_INUMBER, name, 0644) < 0) break;
+    created++;
+  }
+  CHECK(created == freeInodes);
+  CHECK(testdisk_countfreeinodes(fs) == 0);
+  for (int i = 0; i < created; i++) {
+    snprintf(name, sizeof(name), "i%d", i);
+    CHECK(file_unlink(fs, ROOT_INUMBER, name) == 0);
+  }
+  CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+  CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+
+  CheckConcurrentAllocation(fs, freeInodes);
+
+  // all of it has to be on disk once the image is closed
+  CHECK(unixfilesystem_sync(fs) == 0);
+  unixfilesystem_free(fs);
+  CHECK(diskimg_close(fd) == 0);
+  fd = diskimg_open(path, DISKIMG_READONLY);
+  fs = fd < 0 ? NULL : unixfilesystem_init(fd);
+  if (CHECK(fs != NULL)) {
+    CHECK(pathname_lookup(fs, "/a") < 0);
+    CHECK(pathname_lookup(fs, "/full") < 0);
+    CHECK(pathname_lookup(fs, "/b") == b);
+    CHECK(pathname_lookup(fs, "/d/small") == small);
+    CHECK(testdisk_filesize(fs, b) == 100000);
+    CHECK(testdisk_checkcontents(fs, b, 0, 100000, 0) == 0);
+    CHECK(testdisk_filesize(fs, small) == 5000);
+    CHECK(testdisk_checkcontents(fs, small, 0, 100, 1) == 0);
+    CHECK(testdisk_checkcontents(fs, small, 100, 1000, 0) == 0);
+    CHECK(testdisk_checkcontents(fs, small, 1100, 3900, 1) == 0);
+    CHECK(inode_iget(fs, ROOT_INUMBER, &in) == 0 && in.i_nlink == 3 && inode_getsize(&in) == 4 * 16);
+    CHECK(testdisk_countfreeblocks(fs) == freeBlocks);
+    CHECK(testdisk_countfreeinodes(fs) == freeInodes);
+    unixfilesystem_free(fs);
+    diskimg_close(fd);
+  }
+  unlink(path);
+  printf("%s: %s\n", label, testdisk_failures == failuresBefore ? "ok" : "FAILED");
+}
+
+int main(int argc, char *argv[]) {
+  RunTests("write-back", DISKIMG_WRITEBACK, DISKIMG_DEFAULT_CACHE_SECTORS);
+  RunTests("write-back, 16-sector cache", DISKIMG_WRITEBACK, 16);
+  RunTests("write-through", 0, DISKIMG_DEFAULT_CACHE_SECTORS);
+  RunTests("no cache", 0, 0);
+  exit(testdisk_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}